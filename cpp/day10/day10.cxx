@@ -1,133 +1,553 @@
+#include <cstdio>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
 #include <vector>
 #include <string>
 #include <fstream>
+#include <iterator>
+#include <array>
+#include <algorithm>
+#include <thread>
+#include <fcntl.h>
+#include <unistd.h>
 
-static std::string get_complete_set(const char& brace)
+// A pair of brackets in a dialect and what they score
+struct BracketPair {
+	char opener;
+	char closer;
+	int error_score;
+	int completion_points;
+};
+
+// The brackets from the puzzle
+struct AocDialect {
+	static constexpr BracketPair pairs[] = {
+		{'(', ')', 3, 1},
+		{'[', ']', 57, 2},
+		{'{', '}', 1197, 3},
+		{'<', '>', 25137, 4},
+	};
+};
+
+// The puzzle brackets plus Latin-1 guillemets and backtick/apostrophe as the
+// ASCII stand in for angle brackets
+struct ExtendedDialect {
+	static constexpr BracketPair pairs[] = {
+		{'(', ')', 3, 1},
+		{'[', ']', 57, 2},
+		{'{', '}', 1197, 3},
+		{'<', '>', 25137, 4},
+		{'\xab', '\xbb', 52689, 5},
+		{'`', '\'', 99999, 6},
+	};
+};
+
+enum BracketClass : uint8_t {
+	NOT_BRACKET,
+	OPENER,
+	CLOSER,
+};
+
+// Everything the validator needs to know about one byte
+struct ByteInfo {
+	BracketClass bracket_class;
+	char closer;		// for openers, the bracket that closes them
+	int error_score;	// for closers
+	int completion_points;	// for closers
+};
+
+// Per byte lookup table for a dialect, built at compile time
+template <typename Dialect>
+struct BracketTable {
+	static constexpr std::array<ByteInfo, 256> build(void)
+	{
+		std::array<ByteInfo, 256> table = {};
+		for (auto& info: table) {
+			info = {NOT_BRACKET, 0, 0, 0};
+		}
+		for (auto& pair: Dialect::pairs) {
+			table[(uint8_t)pair.opener] = {OPENER, pair.closer, 0, 0};
+			table[(uint8_t)pair.closer] = {CLOSER, 0, pair.error_score, pair.completion_points};
+		}
+		return table;
+	}
+
+	static constexpr std::array<ByteInfo, 256> bytes = build();
+};
+
+template <typename Dialect>
+static const ByteInfo& get_byte_info(char c)
 {
-	std::string completed;
-	switch (brace) {
-		case '(':
-			completed = "()";
-			break;
-		case '[':
-			completed = "[]";
-			break;
-		case '{':
-			completed = "{}";
-			break;
-		case '<':
-			completed = "<>";
-			break;
-		default:
-			completed = "ERROR";
-			break;
+	return BracketTable<Dialect>::bytes[(uint8_t)c];
+}
+
+template <typename Dialect>
+static int get_completion_points(char brace)
+{
+	return BracketTable<Dialect>::bytes[(uint8_t)brace].completion_points;
+}
+
+enum LineStatus : uint8_t {
+	INCOMPLETE,
+	CORRUPTED,
+	INVALID,	// has a character that isn't a bracket, not scored
+};
+
+// Result of checking a single line
+struct LineScore {
+	LineStatus status;
+	uint64_t score;	// syntax error score if corrupted, else the completion score
+};
+
+// Scores the closers still expected, innermost last. Lines that leave more than
+// 27 brackets open overflow 64 bits, so the score wraps around the same way
+// however the line was checked.
+template <typename Dialect>
+static uint64_t get_completion_score(const std::vector<char>& closers)
+{
+	uint64_t score = 0;
+	for (auto it = closers.rbegin(); it != closers.rend(); it++) {
+		score *= 5;
+		score += get_completion_points<Dialect>(*it);
 	}
+	return score;
+}
 
-	return completed;
+// Checks a line in a single pass. Every opening bracket pushes the bracket that
+// should close it, and every closing bracket has to match the top of the stack.
+// The first one that doesn't is the corruption. If the line runs out first, the
+// brackets left on the stack (top first) are its completion. A character that
+// isn't a bracket makes the line invalid, unless it comes after the corruption.
+// stack is scratch
+// space that callers reuse between lines, so it only allocates when a line
+// nests deeper than any line before it.
+template <typename Dialect>
+static LineScore score_line(const char *line, size_t len, std::vector<char>& stack)
+{
+	stack.clear();
+	for (size_t i = 0; i < len; i++) {
+		const ByteInfo& info = get_byte_info<Dialect>(line[i]);
+		if (info.bracket_class == OPENER) {
+			stack.push_back(info.closer);
+		} else if (info.bracket_class == NOT_BRACKET) {
+			return {INVALID, 0};
+		} else if (stack.empty() || stack.back() != line[i]) {
+			return {CORRUPTED, (uint64_t)info.error_score};
+		} else {
+			stack.pop_back();
+		}
+	}
+
+	return {INCOMPLETE, get_completion_score<Dialect>(stack)};
 }
 
-static std::string build_expected_line(const std::string& input_line)
+// What's left of a chunk of a line after matching up the brackets inside it
+struct ChunkSummary {
+	size_t error_pos = SIZE_MAX;			// first mismatched closer or non-bracket
+	std::vector<std::pair<size_t, char>> closers;	// closers with no opener in the chunk
+	std::vector<char> openers;			// closers still expected, innermost last
+};
+
+template <typename Dialect>
+static void summarize_chunk(const char *line, size_t start, size_t end, ChunkSummary& summary)
 {
-	// For all open brackets, close the brackets and insert into the expected string
-	std::string expected_line = "";
-	const std::string closing_brackets = ")]}>";
-	for (int i = 0; i < input_line.length(); i++) {
-		char c = input_line[i];
-		if (closing_brackets.find(c) == std::string::npos) {
-			std::string complete_set = get_complete_set(c);
-			expected_line.insert(i, complete_set);
+	for (size_t i = start; i < end; i++) {
+		const ByteInfo& info = get_byte_info<Dialect>(line[i]);
+		if (info.bracket_class == OPENER) {
+			summary.openers.push_back(info.closer);
+		} else if (info.bracket_class == NOT_BRACKET) {
+			summary.error_pos = i;
+			return;
+		} else if (summary.openers.empty()) {
+			// Might be matched by an opener in an earlier chunk
+			summary.closers.push_back(std::make_pair(i, line[i]));
+		} else if (summary.openers.back() != line[i]) {
+			summary.error_pos = i;
+			return;
+		} else {
+			summary.openers.pop_back();
+		}
+	}
+}
+
+// Appends the summary of the chunk that follows, matching its leftover closers
+// against our leftover openers
+static void merge_chunks(ChunkSummary& left, const ChunkSummary& right)
+{
+	if (left.error_pos != SIZE_MAX) {
+		return;
+	}
+
+	for (auto& closer: right.closers) {
+		if (left.openers.empty()) {
+			left.closers.push_back(closer);
+		} else if (left.openers.back() != closer.second) {
+			left.error_pos = closer.first;
+			return;
+		} else {
+			left.openers.pop_back();
 		}
 	}
 
-	return expected_line;
+	if (right.error_pos != SIZE_MAX) {
+		left.error_pos = right.error_pos;
+		return;
+	}
+	left.openers.insert(left.openers.end(), right.openers.begin(), right.openers.end());
 }
 
-static int get_error_score(const char& brace)
-{
-	switch (brace) {
-		case ')':
-			return 3;
-		case ']':
-			return 57;
-		case '}':
-			return 1197;
-		case '>':
-			return 25137;
-		default:
-			printf("Unknown char %c, can't calculate error score.\n", brace);
-			return -1;
+// Same result as score_line(), for very long lines. The line is split into
+// chunks that are reduced to their unmatched closers and openers on separate
+// threads, then the chunk summaries are merged left to right. Lines too short
+// to give every thread min_chunk_size characters use fewer threads, and lines
+// that would only get one chunk are scored on the calling thread with stack.
+template <typename Dialect>
+static LineScore score_line_parallel(const char *line, size_t len, int num_threads,
+				     std::vector<char>& stack, size_t min_chunk_size = 1 << 20)
+{
+	size_t num_chunks = std::max<size_t>(1, std::min<size_t>(num_threads, len / min_chunk_size));
+	if (num_chunks == 1) {
+		return score_line<Dialect>(line, len, stack);
+	}
+
+	std::vector<ChunkSummary> summaries(num_chunks);
+	std::vector<std::thread> threads;
+	for (size_t c = 0; c < num_chunks; c++) {
+		threads.emplace_back([&, c]() {
+			summarize_chunk<Dialect>(line, len * c / num_chunks, len * (c + 1) / num_chunks,
+					summaries[c]);
+		});
+	}
+	for (auto& thread: threads) {
+		thread.join();
+	}
+
+	ChunkSummary& total = summaries[0];
+	for (size_t c = 1; c < num_chunks; c++) {
+		merge_chunks(total, summaries[c]);
+	}
+
+	// Closers left over at the start of the line never had an opener, so the
+	// first of those is corrupt too
+	size_t error_pos = total.error_pos;
+	if (!total.closers.empty()) {
+		error_pos = std::min(error_pos, total.closers[0].first);
 	}
+	if (error_pos != SIZE_MAX) {
+		const ByteInfo& info = get_byte_info<Dialect>(line[error_pos]);
+		if (info.bracket_class == NOT_BRACKET) {
+			return {INVALID, 0};
+		}
+		return {CORRUPTED, (uint64_t)info.error_score};
+	}
+
+	return {INCOMPLETE, get_completion_score<Dialect>(total.openers)};
 }
 
-static int get_completion_points(const char& brace)
+// Same checks as score_line() on input that arrives in arbitrary pieces. The
+// stack and the state of the current line carry over between calls to feed(),
+// so a line can be split anywhere without copying it back together. Lines are
+// whitespace separated, as they are for the other modes.
+template <typename Dialect>
+class BracketValidator
 {
-	switch (brace) {
-		case ')':
-			return 1;
-		case ']':
-			return 2;
-		case '}':
-			return 3;
-		case '>':
-			return 4;
-		default:
-			printf("Unknown char %c, can't calculate completion score.\n", brace);
-			return -1;
+public:
+	// Passes the score of each line to sink(const LineScore&) as soon as the
+	// line ends
+	template <typename Sink>
+	void feed(const char *data, size_t len, Sink&& sink);
+
+	// Ends the last line if the input didn't end with a newline
+	template <typename Sink>
+	void finish(Sink&& sink) { feed("\n", 1, sink); }
+private:
+	std::vector<char> m_stack;
+	bool m_in_line = false;		// seen a bracket since the last separator
+	bool m_corrupted = false;	// already scored, skip to the next separator
+};
+
+template <typename Dialect>
+template <typename Sink>
+void BracketValidator<Dialect>::feed(const char *data, size_t len, Sink&& sink)
+{
+	for (size_t i = 0; i < len; i++) {
+		char c = data[i];
+		if (c == '\n' || c == '\r' || c == ' ' || c == '\t') {
+			if (m_in_line && !m_corrupted) {
+				sink(LineScore{INCOMPLETE, get_completion_score<Dialect>(m_stack)});
+			}
+			m_stack.clear();
+			m_in_line = false;
+			m_corrupted = false;
+			continue;
+		}
+		if (m_corrupted) {
+			continue;
+		}
+
+		m_in_line = true;
+		const ByteInfo& info = get_byte_info<Dialect>(c);
+		if (info.bracket_class == OPENER) {
+			m_stack.push_back(info.closer);
+		} else if (info.bracket_class == NOT_BRACKET) {
+			sink(LineScore{INVALID, 0});
+			m_corrupted = true;
+		} else if (m_stack.empty() || m_stack.back() != c) {
+			sink(LineScore{CORRUPTED, (uint64_t)info.error_score});
+			m_corrupted = true;
+		} else {
+			m_stack.pop_back();
+		}
+	}
+}
+
+// Scores for a set of lines
+struct BatchScores {
+	long syntax_error_score = 0;
+	std::vector<uint64_t> completion_scores;
+	long num_invalid = 0;	// lines left out of both scores
+};
+
+static void add_line_score(const LineScore& result, BatchScores& scores)
+{
+	if (result.status == CORRUPTED) {
+		scores.syntax_error_score += result.score;
+	} else if (result.status == INCOMPLETE) {
+		scores.completion_scores.push_back(result.score);
+	} else {
+		scores.num_invalid++;
 	}
 }
 
-int main()
-{
-	std::vector<std::string> input_lines;
-	std::vector<std::string> expected_lines;
-	std::vector<int> incomplete_line_indexes;
-
-	// Save input lines and build expected lines
-	std::string input_line;
-	std::ifstream input("../day10/input.txt");
-	while (input >> input_line) {
-		std::string expected_line = build_expected_line(input_line);
-		input_lines.push_back(input_line);
-		expected_lines.push_back(expected_line);
-	}
-
-	// Part 1: compare the input lines to expected lines looking for mismatched
-	// characters and tally up the syntax error score based on those mismatched chars.
-	int syntax_error_score = 0;
-	for (int i = 0; i < input_lines.size(); i++) {
-		bool corrupted_line = false;
-		for (int j = 0; j < input_lines[i].length(); j++) {
-			char input = input_lines[i][j];
-			char expected = expected_lines[i][j];
-			if (input != expected) {
-				corrupted_line = true;
-				syntax_error_score += get_error_score(input);
+// Scores whitespace separated lines on a pool of threads. Each thread takes an
+// equal share of the lines and keeps its own scores, nothing is shared until
+// the threads are done.
+template <typename Dialect>
+static void score_lines_batch(const std::string& data, int num_threads,
+			      std::vector<BatchScores>& thread_scores)
+{
+	// Find where each line starts and ends
+	std::vector<std::pair<size_t, size_t>> lines;
+	size_t pos = data.find_first_not_of(" \t\r\n");
+	while (pos != std::string::npos) {
+		size_t end = std::min(data.find_first_of(" \t\r\n", pos), data.length());
+		lines.push_back(std::make_pair(pos, end - pos));
+		pos = data.find_first_not_of(" \t\r\n", end);
+	}
+
+	num_threads = std::max(1, std::min<int>(num_threads, lines.size()));
+	thread_scores.assign(num_threads, BatchScores());
+	std::vector<std::thread> threads;
+	for (int t = 0; t < num_threads; t++) {
+		threads.emplace_back([&, t]() {
+			std::vector<char> stack;
+			BatchScores& scores = thread_scores[t];
+			size_t start = lines.size() * t / num_threads;
+			size_t end = lines.size() * (t + 1) / num_threads;
+			for (size_t i = start; i < end; i++) {
+				add_line_score(score_line<Dialect>(&data[lines[i].first],
+								   lines[i].second, stack), scores);
+			}
+		});
+	}
+	for (auto& thread: threads) {
+		thread.join();
+	}
+}
+
+// Middle of all the completion scores, i.e. element size / 2 if they were all
+// sorted. Gathers them in one vector and partially sorts it.
+static uint64_t find_median(std::vector<BatchScores>& batches)
+{
+	std::vector<uint64_t> all_scores = std::move(batches[0].completion_scores);
+	for (size_t b = 1; b < batches.size(); b++) {
+		all_scores.insert(all_scores.end(), batches[b].completion_scores.begin(),
+				  batches[b].completion_scores.end());
+		std::vector<uint64_t>().swap(batches[b].completion_scores);
+	}
+
+	auto middle = all_scores.begin() + all_scores.size() / 2;
+	std::nth_element(all_scores.begin(), middle, all_scores.end());
+	return *middle;
+}
+
+// Same result as find_median() without gathering or reordering the scores.
+// Radix select picks the median 16 bits at a time from the top, counting the
+// scores that match the bits picked so far in a fixed size histogram, so the
+// only extra memory is the histogram.
+static uint64_t find_median_bounded(const std::vector<BatchScores>& batches)
+{
+	size_t num_scores = 0;
+	for (auto& batch: batches) {
+		num_scores += batch.completion_scores.size();
+	}
+
+	uint64_t prefix = 0;
+	uint64_t prefix_mask = 0;
+	size_t k = num_scores / 2;
+	std::vector<size_t> histogram(1 << 16);
+	for (int shift = 48; shift >= 0; shift -= 16) {
+		std::fill(histogram.begin(), histogram.end(), 0);
+		for (auto& batch: batches) {
+			for (uint64_t score: batch.completion_scores) {
+				if ((score & prefix_mask) == prefix) {
+					histogram[(score >> shift) & 0xffff]++;
+				}
 			}
 		}
 
-		if (!corrupted_line) {
-			incomplete_line_indexes.push_back(i);
+		size_t digit = 0;
+		while (k >= histogram[digit]) {
+			k -= histogram[digit];
+			digit++;
 		}
+		prefix |= (uint64_t)digit << shift;
+		prefix_mask |= (uint64_t)0xffff << shift;
 	}
 
-	printf("Part 1: %d\n", syntax_error_score);
+	return prefix;
+}
 
+// Scores the lines of a file (or stdin for "-") as it is read, without ever
+// holding a whole line
+template <typename Dialect>
+static int score_stream(const char *path, BatchScores& scores)
+{
+	int fd = STDIN_FILENO;
+	if (strcmp(path, "-") != 0) {
+		fd = open(path, O_RDONLY);
+		if (fd < 0) {
+			printf("Failed to open input file.\n");
+			return -1;
+		}
+	}
 
-	// Part 2: Caculate completion scores by looking at the characters added to
-	// create the expected lines. Then sort the scores and take the middle one.
-	std::vector<long> completion_scores;
-	for (int i: incomplete_line_indexes) {
-		long completion_score = 0;
-		for (int j = input_lines[i].length(); j < expected_lines[i].length(); j++) {
-			completion_score *= 5;
-			completion_score += get_completion_points(expected_lines[i][j]);
+	char buf[64 * 1024];
+	BracketValidator<Dialect> validator;
+	auto sink = [&scores](const LineScore& result) { add_line_score(result, scores); };
+	ssize_t len;
+	int ret = 0;
+	while ((len = read(fd, buf, sizeof(buf))) != 0) {
+		if (len < 0) {
+			printf("Failed to read input.\n");
+			ret = -1;
+			break;
+		}
+		validator.feed(buf, len, sink);
+	}
+	if (ret == 0) {
+		validator.finish(sink);
+	}
+
+	if (fd != STDIN_FILENO) {
+		close(fd);
+	}
+	return ret;
+}
+
+struct Options {
+	const char *input_path = "../day10/input.txt";
+	int num_threads = 0;
+	bool batch = false;
+	bool bounded_median = false;
+	bool streaming = false;
+};
+
+template <typename Dialect>
+static int run(const Options& options)
+{
+	// Part 1: tally up the syntax error score of the first mismatched character
+	// on each corrupted line.
+	// Part 2: for the incomplete lines, score the characters needed to
+	// complete them and take the middle score.
+	std::vector<BatchScores> batches;
+	std::ifstream input;
+	if (!options.streaming) {
+		input.open(options.input_path);
+		if (!input) {
+			printf("Failed to open input file.\n");
+			return 1;
+		}
+	}
+
+	if (options.streaming) {
+		batches.resize(1);
+		if (score_stream<Dialect>(options.input_path, batches[0]) != 0) {
+			return 1;
+		}
+	} else if (options.batch) {
+		// The threads split the lines, so each line is scored sequentially
+		std::string data((std::istreambuf_iterator<char>(input)),
+				 std::istreambuf_iterator<char>());
+		int num_threads = options.num_threads;
+		if (num_threads == 0) {
+			num_threads = std::max(1u, std::thread::hardware_concurrency());
+		}
+		score_lines_batch<Dialect>(data, num_threads, batches);
+	} else {
+		batches.resize(1);
+		std::vector<char> stack;
+		std::string input_line;
+		while (input >> input_line) {
+			LineScore result;
+			if (options.num_threads > 0) {
+				result = score_line_parallel<Dialect>(input_line.data(),
+								      input_line.length(),
+								      options.num_threads, stack);
+			} else {
+				result = score_line<Dialect>(input_line.data(), input_line.length(), stack);
+			}
+			add_line_score(result, batches[0]);
 		}
-		completion_scores.push_back(completion_score);
 	}
 
-	std::sort(completion_scores.begin(), completion_scores.end());
-	size_t middle = completion_scores.size() / 2;
-	printf("Part 2: %ld\n", completion_scores[middle]);
+	long syntax_error_score = 0;
+	long num_invalid = 0;
+	bool any_incomplete = false;
+	for (auto& b: batches) {
+		syntax_error_score += b.syntax_error_score;
+		num_invalid += b.num_invalid;
+		any_incomplete |= !b.completion_scores.empty();
+	}
+	printf("Part 1: %ld\n", syntax_error_score);
 
+	if (any_incomplete) {
+		uint64_t median = options.bounded_median ? find_median_bounded(batches) :
+							   find_median(batches);
+		printf("Part 2: %lu\n", (unsigned long)median);
+	}
+
+	if (num_invalid > 0) {
+		printf("Lines with characters that aren't brackets: %ld\n", num_invalid);
+		return 1;
+	}
 	return 0;
 }
+
+int main(int argc, char *argv[])
+{
+	Options options;
+	bool extended = false;
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+			options.num_threads = atoi(argv[++i]);
+			if (options.num_threads <= 0) {
+				printf("Invalid number of threads %s.\n", argv[i]);
+				return 1;
+			}
+		} else if (strcmp(argv[i], "--batch") == 0) {
+			options.batch = true;
+		} else if (strcmp(argv[i], "--stream") == 0) {
+			options.streaming = true;
+		} else if (strcmp(argv[i], "--bounded-median") == 0) {
+			options.bounded_median = true;
+		} else if (strcmp(argv[i], "--extended") == 0) {
+			extended = true;
+		} else {
+			options.input_path = argv[i];
+		}
+	}
+
+	return extended ? run<ExtendedDialect>(options) : run<AocDialect>(options);
+}
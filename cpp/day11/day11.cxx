@@ -1,145 +1,1293 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <cctype>
+#include <string>
 #include <fstream>
 #include <vector>
+#include <algorithm>
+#include <thread>
+#include <chrono>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
-#define NUM_GRID_ROWS	(10)
-#define NUM_GRID_COLS	(10)
+// Energy level at which an octopus flashes
+#define FLASH_ENERGY	(10)
 
-static const int NEIGHBOR_INDEXES[8][2] = {
-	{-1, -1}, {-1, 0}, {-1, 1},
-	{ 0, -1},          { 0, 1},
-	{ 1, -1}, { 1, 0}, { 1, 1}
-};
+// Rows are padded to a multiple of this so step_simd() can work on whole
+// vectors
+#define VECTOR_WIDTH	(32)
+
+typedef uint8_t u8x32 __attribute__((vector_size(VECTOR_WIDTH)));
+typedef uint64_t u64x4 __attribute__((vector_size(VECTOR_WIDTH)));
 
-struct Position {
-	int row;
-	int col;
+// Everything OctopusBatch keeps about one cell, one bit per board. Without
+// AVX, GCC only aligns 32 byte vectors to 16 bytes, but the AVX2 build of
+// OctopusBatch::step() expects the full width.
+struct alignas(VECTOR_WIDTH) LaneCell {
+	u64x4 planes[4];	// bit k of the energy level in planes[k]
+	u64x4 flashed;
+	u64x4 new_flashes;
+	u64x4 row_sums[2];	// bits of the new flashes at col - 1 to col + 1
 };
 
-struct Octopus {
-	int energy_level;
-	bool flashed;
-	Position pos;
+// Number of boards OctopusBatch steps at once, one per bit of a u64x4
+#define BATCH_SIZE	(8 * VECTOR_WIDTH)
+
+// Bits in OctopusBatch's flash counters
+#define COUNTER_BITS	(40)
+
+// Rows of the grid that one thread steps in OctopusGrid::step_parallel().
+// Increments for the rows just outside the band are counted in halos, which
+// are double buffered so a band can send the next round's while its
+// neighbor is still reading the last one's.
+struct GridBand {
+	int first_row;			// padded rows first_row to end_row - 1
+	int end_row;
+	size_t head = 0;		// next cell in to_flash to flash
+	std::vector<uint32_t> to_flash;
+	std::vector<uint8_t> halo_up[2];
+	std::vector<uint8_t> halo_down[2];
+	bool sent_up[2] = {};
+	bool sent_down[2] = {};
 };
 
+// The grid keeps a one cell border around the octopuses so neighbors never
+// need a bounds check. Energy levels and flash states are kept in separate
+// arrays, indexed by (row + 1) * stride + (col + 1). The border cells are
+// marked as flashed for good, so a cascade never spreads into them.
 class OctopusGrid
 {
 public:
+	OctopusGrid(int num_rows, int num_cols);
 	void display(void);
 	void step(void);
-	void add_octopus(Octopus octopus);
-	int get_num_flashes(void) { return m_num_flashes; }
+	void step_simd(void);
+	void step_parallel(int num_threads);
+	void set_energy(int row, int col, uint8_t energy) { m_energy[index(row, col)] = energy; }
+	uint8_t get_energy(int row, int col) { return m_energy[index(row, col)]; }
+	int get_num_rows(void) { return m_num_rows; }
+	int get_num_cols(void) { return m_num_cols; }
+	long get_num_flashes(void) { return m_num_flashes; }
+	long get_step_flashes(void) { return m_step_flashes; }
+	bool did_flash(int row, int col) { return m_flashed[index(row, col)]; }
+	// Longest chain of flashes setting each other off in the last step. Not
+	// tracked by step_parallel(), which leaves it at 0.
+	int get_cascade_depth(void) { return m_cascade_depth; }
 	bool did_all_flash_together(void) { return m_all_flashed; }
+	uint64_t hash_state(void);
+	bool has_same_state(const OctopusGrid& other) { return m_energy == other.m_energy; }
 private:
-	int m_num_flashes = 0;
+	int m_num_rows;
+	int m_num_cols;
+	size_t m_stride;
+	long m_num_flashes = 0;
+	long m_step_flashes = 0;
+	int m_cascade_depth = 0;
 	bool m_all_flashed = false;
-	Octopus m_grid[NUM_GRID_ROWS][NUM_GRID_COLS];
-	bool is_valid_pos(int row, int col);
-	void try_flash(Octopus& octopus);
+	std::vector<uint8_t> m_energy;
+	std::vector<uint8_t> m_flashed;
+	std::vector<uint32_t> m_to_flash;	// queue of cells that reached FLASH_ENERGY
+	std::vector<uint8_t> m_border;		// 1 in the border columns of a row
+	std::vector<uint8_t> m_new_flashes;	// cells that flashed in the last round
+	std::vector<uint8_t> m_block_queued;	// one per vector, set if it's in m_to_check
+	std::vector<uint32_t> m_to_check;	// vectors that might flash this round
+	std::vector<uint32_t> m_new_blocks;	// vectors with a flash in the last round
+	std::vector<GridBand> m_bands;
+	size_t index(int row, int col) { return (row + 1) * m_stride + col + 1; }
+	__attribute__((always_inline)) inline void step_vectors(void);
+#if defined(__GNUC__) && defined(__x86_64__)
+	void step_vectors_avx2(void);
+#endif
+	void step_band(int b, int round);
+	void receive_halo(GridBand& band, std::vector<uint8_t>& halo, int row);
 };
 
+OctopusGrid::OctopusGrid(int num_rows, int num_cols)
+	: m_num_rows(num_rows), m_num_cols(num_cols),
+	  m_stride((num_cols + 2 + VECTOR_WIDTH - 1) / VECTOR_WIDTH * VECTOR_WIDTH)
+{
+	size_t size = (num_rows + 2) * m_stride;
+	m_energy.assign(size, 0);
+	m_flashed.assign(size, 1);
+	for (int row = 0; row < num_rows; row++) {
+		memset(&m_flashed[index(row, 0)], 0, num_cols);
+	}
+
+	m_border.assign(m_stride, 1);
+	memset(&m_border[1], 0, num_cols);
+
+	// Neighbor sums read one byte either side of the grid, so leave a
+	// vector of slack at both ends
+	m_new_flashes.assign(size + 2 * VECTOR_WIDTH, 0);
+
+	// Like m_flashed, the border rows (and a flag either side of them) are
+	// flagged for good so they never get checked
+	m_block_queued.assign(size / VECTOR_WIDTH + 2, 1);
+	memset(&m_block_queued[1 + m_stride / VECTOR_WIDTH], 0, num_rows * m_stride / VECTOR_WIDTH);
+}
+
 void OctopusGrid::display(void)
 {
-	for (int row = 0; row < NUM_GRID_ROWS; row++) {
-		for (int col = 0; col < NUM_GRID_COLS; col++) {
-			Octopus octopus = m_grid[row][col];
-			printf("%d%s ", octopus.energy_level, octopus.flashed ? "*" : " ");
+	for (int row = 0; row < m_num_rows; row++) {
+		for (int col = 0; col < m_num_cols; col++) {
+			size_t i = index(row, col);
+			printf("%d%s ", m_energy[i], m_flashed[i] ? "*" : " ");
 		}
 		printf("\n");
 	}
 	printf("\n");
 }
 
-void OctopusGrid::add_octopus(Octopus octopus)
+void OctopusGrid::step(void)
 {
-	m_grid[octopus.pos.row][octopus.pos.col] = octopus;
+	// First increase energy level of all octopuses by 1 and clear flash
+	// status from previous steps. Anything that gets to FLASH_ENERGY is
+	// queued up to flash.
+	m_to_flash.clear();
+	for (int row = 0; row < m_num_rows; row++) {
+		size_t start = index(row, 0);
+		for (size_t i = start; i < start + m_num_cols; i++) {
+			m_flashed[i] = 0;
+			if (++m_energy[i] == FLASH_ENERGY) {
+				m_flashed[i] = 1;
+				m_to_flash.push_back(i);
+			}
+		}
+	}
+
+	// Handle octopus flashes. Each octopus is queued the moment it reaches
+	// FLASH_ENERGY, which happens at most once per step, and flashed octopuses
+	// (and the border) are never queued again.
+	const long offsets[8] = {
+		-(long)m_stride - 1, -(long)m_stride, -(long)m_stride + 1,
+		-1,                                   1,
+		(long)m_stride - 1,  (long)m_stride,  (long)m_stride + 1
+	};
+	size_t level_end = m_to_flash.size();
+	m_cascade_depth = level_end > 0;
+	for (size_t head = 0; head < m_to_flash.size(); head++) {
+		// The queue holds the flashes one link further down the chain
+		// after each level
+		if (head == level_end) {
+			m_cascade_depth++;
+			level_end = m_to_flash.size();
+		}
+
+		size_t i = m_to_flash[head];
+		for (long offset: offsets) {
+			size_t n = i + offset;
+			if (!m_flashed[n] && ++m_energy[n] == FLASH_ENERGY) {
+				m_flashed[n] = 1;
+				m_to_flash.push_back(n);
+			}
+		}
+	}
+
+	// Check if all octopuses flashed at the same time
+	m_step_flashes = m_to_flash.size();
+	m_num_flashes += m_step_flashes;
+	if (m_step_flashes == (long)m_num_rows * m_num_cols) {
+		m_all_flashed = true;
+	}
+
+	// Reset flashed octopuses back to 0
+	for (uint32_t i: m_to_flash) {
+		m_energy[i] = 0;
+	}
 }
 
-bool OctopusGrid::is_valid_pos(int row, int col)
+// Same as step(), a vector of cells at a time. Cells at or above
+// FLASH_ENERGY that haven't flashed yet are found with a compare, then every
+// cell adds up the new flashes around it from eight shifted loads of the
+// flash mask. That repeats until a round finds no new flashes. Only vectors
+// next to one that flashed in the last round can change, so each round only
+// visits those. Energy can't go past 9 + 1 + 8, so it never overflows a byte.
+void OctopusGrid::step_vectors(void)
 {
-	return (row >= 0 && row < NUM_GRID_ROWS && col >= 0 && col < NUM_GRID_COLS);
+	size_t block_stride = m_stride / VECTOR_WIDTH;
+	uint8_t *block_queued = &m_block_queued[1];
+	const uint8_t *new_flashes = &m_new_flashes[VECTOR_WIDTH];
+	u8x32 border;
+
+	// First increase energy level of all octopuses by 1 and clear flash
+	// status from previous steps
+	m_to_check.clear();
+	m_cascade_depth = 0;
+	for (int row = 1; row <= m_num_rows; row++) {
+		uint8_t *energy = &m_energy[row * m_stride];
+		uint8_t *flashed = &m_flashed[row * m_stride];
+		for (size_t col = 0; col < m_stride; col += VECTOR_WIDTH) {
+			u8x32 e;
+			memcpy(&e, energy + col, sizeof(e));
+			memcpy(&border, &m_border[col], sizeof(border));
+			e += 1;
+			memcpy(energy + col, &e, sizeof(e));
+			memcpy(flashed + col, &border, sizeof(border));
+			m_to_check.push_back(row * m_stride + col);
+		}
+	}
+
+	// Handle octopus flashes a round at a time. A vector's new flash mask is
+	// only ever non-zero if it is checked in the next round, which clears it
+	// again, so the masks are all zero between steps. Vectors are tracked by
+	// the index of their first cell. The vectors either side of one wrap
+	// around to the next and previous rows, which only costs a wasted check
+	// of the border.
+	const long block_offsets[9] = {
+		-(long)block_stride - 1, -(long)block_stride, -(long)block_stride + 1,
+		-1,                      0,                   1,
+		(long)block_stride - 1,  (long)block_stride,  (long)block_stride + 1
+	};
+	while (true) {
+		m_new_blocks.clear();
+		for (uint32_t i: m_to_check) {
+			u8x32 e, f;
+			memcpy(&e, &m_energy[i], sizeof(e));
+			memcpy(&f, &m_flashed[i], sizeof(f));
+			u8x32 n = (u8x32)(e >= FLASH_ENERGY) & (f ^ 1) & 1;
+			f |= n;
+			memcpy(&m_flashed[i], &f, sizeof(f));
+			memcpy(&m_new_flashes[VECTOR_WIDTH + i], &n, sizeof(n));
+
+			uint64_t words[VECTOR_WIDTH / 8];
+			memcpy(words, &n, sizeof(words));
+			if ((words[0] | words[1] | words[2] | words[3]) != 0) {
+				m_new_blocks.push_back(i);
+			}
+		}
+		if (m_new_blocks.empty()) {
+			break;
+		}
+		m_cascade_depth++;
+
+		m_to_check.clear();
+		for (uint32_t i: m_new_blocks) {
+			size_t b = i / VECTOR_WIDTH;
+			for (long offset: block_offsets) {
+				if (!block_queued[b + offset]) {
+					block_queued[b + offset] = 1;
+					m_to_check.push_back((b + offset) * VECTOR_WIDTH);
+				}
+			}
+		}
+
+		for (uint32_t i: m_to_check) {
+			block_queued[i / VECTOR_WIDTH] = 0;
+
+			const uint8_t *up = new_flashes + i - m_stride;
+			const uint8_t *mid = new_flashes + i;
+			const uint8_t *down = new_flashes + i + m_stride;
+			u8x32 e, n, sum = {};
+			for (const uint8_t *p: {up, mid, down}) {
+				memcpy(&n, p - 1, sizeof(n));
+				sum += n;
+				memcpy(&n, p + 1, sizeof(n));
+				sum += n;
+			}
+			memcpy(&n, up, sizeof(n));
+			sum += n;
+			memcpy(&n, down, sizeof(n));
+			sum += n;
+
+			memcpy(&e, &m_energy[i], sizeof(e));
+			e += sum;
+			memcpy(&m_energy[i], &e, sizeof(e));
+		}
+	}
+
+	// Count the flashes and reset flashed octopuses (and the border, which
+	// picks up energy from flashes next to it) back to 0
+	m_step_flashes = 0;
+	for (int row = 1; row <= m_num_rows; row++) {
+		uint8_t *energy = &m_energy[row * m_stride];
+		uint8_t *flashed = &m_flashed[row * m_stride];
+		for (size_t col = 0; col < m_stride; col += VECTOR_WIDTH) {
+			u8x32 e, f;
+			memcpy(&e, energy + col, sizeof(e));
+			memcpy(&f, flashed + col, sizeof(f));
+			memcpy(&border, &m_border[col], sizeof(border));
+
+			uint64_t words[VECTOR_WIDTH / 8];
+			u8x32 counted = f & (border ^ 1);
+			memcpy(words, &counted, sizeof(words));
+			for (uint64_t word: words) {
+				m_step_flashes += __builtin_popcountll(word);
+			}
+
+			e &= (u8x32)(f == 0);
+			memcpy(energy + col, &e, sizeof(e));
+		}
+	}
+
+	m_num_flashes += m_step_flashes;
+	if (m_step_flashes == (long)m_num_rows * m_num_cols) {
+		m_all_flashed = true;
+	}
 }
 
-void OctopusGrid::try_flash(Octopus& octopus)
+#if defined(__GNUC__) && defined(__x86_64__)
+// Without AVX2 each vector is split in two, which is slower than step()
+__attribute__((target("avx2")))
+void OctopusGrid::step_vectors_avx2(void)
 {
-	if (octopus.energy_level > 9 && !octopus.flashed) {
-		octopus.flashed = true;
-		m_num_flashes++;
+	step_vectors();
+}
+#endif
 
-		for (auto n: NEIGHBOR_INDEXES) {
-			int n_row = octopus.pos.row + n[0];
-			int n_col = octopus.pos.col + n[1];
-			if (is_valid_pos(n_row, n_col)) {
-				Octopus& neighbor = m_grid[n_row][n_col];
-				neighbor.energy_level++;
-				try_flash(neighbor);
+void OctopusGrid::step_simd(void)
+{
+#if defined(__GNUC__) && defined(__x86_64__)
+	if (__builtin_cpu_supports("avx2")) {
+		step_vectors_avx2();
+		return;
+	}
+#endif
+	step_vectors();
+}
+
+// Adds increments sent by a neighboring band to one of our edge rows
+void OctopusGrid::receive_halo(GridBand& band, std::vector<uint8_t>& halo, int row)
+{
+	size_t start = row * m_stride;
+	for (size_t col = 0; col < m_stride; col++) {
+		if (halo[col] == 0) {
+			continue;
+		}
+		size_t i = start + col;
+		if (!m_flashed[i]) {
+			m_energy[i] += halo[col];
+			if (m_energy[i] >= FLASH_ENERGY) {
+				m_flashed[i] = 1;
+				band.to_flash.push_back(i);
 			}
 		}
+		halo[col] = 0;
 	}
 }
 
-void OctopusGrid::step(void)
+// One round of step_parallel() for band b. The first round adds 1 to every
+// octopus, later ones take the increments the neighboring bands sent in the
+// round before. Then the band's flashes cascade as far as its edges.
+void OctopusGrid::step_band(int b, int round)
+{
+	GridBand& band = m_bands[b];
+	int cur = round & 1;
+	int prev = cur ^ 1;
+	band.sent_up[cur] = false;
+	band.sent_down[cur] = false;
+
+	if (round == 0) {
+		band.to_flash.clear();
+		band.head = 0;
+		for (int row = band.first_row; row < band.end_row; row++) {
+			size_t start = row * m_stride + 1;
+			for (size_t i = start; i < start + m_num_cols; i++) {
+				m_flashed[i] = 0;
+				if (++m_energy[i] == FLASH_ENERGY) {
+					m_flashed[i] = 1;
+					band.to_flash.push_back(i);
+				}
+			}
+		}
+	} else {
+		if (b > 0 && m_bands[b - 1].sent_down[prev]) {
+			receive_halo(band, m_bands[b - 1].halo_down[prev], band.first_row);
+		}
+		if (b + 1 < (int)m_bands.size() && m_bands[b + 1].sent_up[prev]) {
+			receive_halo(band, m_bands[b + 1].halo_up[prev], band.end_row - 1);
+		}
+	}
+
+	// Flashes next to the grid's border fall into the first or last band's
+	// halo, which is never sent
+	size_t lo = band.first_row * m_stride;
+	size_t hi = band.end_row * m_stride;
+	const long offsets[8] = {
+		-(long)m_stride - 1, -(long)m_stride, -(long)m_stride + 1,
+		-1,                                   1,
+		(long)m_stride - 1,  (long)m_stride,  (long)m_stride + 1
+	};
+	for (; band.head < band.to_flash.size(); band.head++) {
+		size_t i = band.to_flash[band.head];
+		for (long offset: offsets) {
+			size_t n = i + offset;
+			if (n < lo) {
+				band.halo_up[cur][n - (lo - m_stride)]++;
+				band.sent_up[cur] = b > 0;
+			} else if (n >= hi) {
+				band.halo_down[cur][n - hi]++;
+				band.sent_down[cur] = b + 1 < (int)m_bands.size();
+			} else if (!m_flashed[n] && ++m_energy[n] == FLASH_ENERGY) {
+				m_flashed[n] = 1;
+				band.to_flash.push_back(n);
+			}
+		}
+	}
+}
+
+// Same as step(), with the grid split into bands of rows on separate
+// threads. Cascades can cross any number of bands, so the bands go in rounds:
+// each cascades as far as it can, then passes on the increments for the rows
+// past its edges, until a round where no band has anything to pass on. Which
+// octopuses flash and where the rest end up doesn't depend on the order the
+// increments arrive in, so the result is the same as step() every time.
+void OctopusGrid::step_parallel(int num_threads)
 {
-	// First increase energy level of all octopuses by 1 and clear
-	// flash status from previous steps
-	for (int row = 0; row < NUM_GRID_ROWS; row++) {
-		for (int col = 0; col < NUM_GRID_COLS; col++) {
-			Octopus& octopus = m_grid[row][col];
-			octopus.flashed = false;
-			octopus.energy_level++;
+	m_cascade_depth = 0;
+	int num_bands = std::max(1, std::min(num_threads, m_num_rows));
+	if ((int)m_bands.size() != num_bands) {
+		m_bands.assign(num_bands, GridBand());
+		for (int b = 0; b < num_bands; b++) {
+			GridBand& band = m_bands[b];
+			band.first_row = 1 + m_num_rows * b / num_bands;
+			band.end_row = 1 + m_num_rows * (b + 1) / num_bands;
+			for (int i = 0; i < 2; i++) {
+				band.halo_up[i].assign(m_stride, 0);
+				band.halo_down[i].assign(m_stride, 0);
+			}
 		}
 	}
 
-	// Handle octopus flashes
-	int prev_num_flashes = m_num_flashes;
-	for (int row = 0; row < NUM_GRID_ROWS; row++) {
-		for (int col = 0; col < NUM_GRID_COLS; col++) {
-			try_flash(m_grid[row][col]);
+	bool any_sent = true;
+	for (int round = 0; any_sent; round++) {
+		std::vector<std::thread> threads;
+		for (int b = 0; b < num_bands; b++) {
+			threads.emplace_back([this, b, round]() { step_band(b, round); });
+		}
+		for (auto& thread: threads) {
+			thread.join();
+		}
+
+		any_sent = false;
+		for (auto& band: m_bands) {
+			any_sent |= band.sent_up[round & 1] || band.sent_down[round & 1];
 		}
 	}
 
 	// Check if all octopuses flashed at the same time
-	if (m_num_flashes - prev_num_flashes == NUM_GRID_ROWS * NUM_GRID_COLS) {
+	m_step_flashes = 0;
+	for (auto& band: m_bands) {
+		m_step_flashes += band.to_flash.size();
+	}
+	m_num_flashes += m_step_flashes;
+	if (m_step_flashes == (long)m_num_rows * m_num_cols) {
 		m_all_flashed = true;
 	}
 
 	// Reset flashed octopuses back to 0
-	for (int row = 0; row < NUM_GRID_ROWS; row++) {
-		for (int col = 0; col < NUM_GRID_COLS; col++) {
-			Octopus& octopus = m_grid[row][col];
-			if (octopus.flashed) {
-				octopus.energy_level = 0;
+	std::vector<std::thread> threads;
+	for (auto& band: m_bands) {
+		threads.emplace_back([this, &band]() {
+			for (uint32_t i: band.to_flash) {
+				m_energy[i] = 0;
 			}
+		});
+	}
+	for (auto& thread: threads) {
+		thread.join();
+	}
+}
+
+// FNV-1a over the energy levels. The energy levels after a step are all
+// there is to the state, the next step only depends on them.
+uint64_t OctopusGrid::hash_state(void)
+{
+	uint64_t hash = 14695981039346656037ULL;
+	for (size_t i = 0; i < m_energy.size(); i += sizeof(uint64_t)) {
+		uint64_t word = 0;
+		memcpy(&word, &m_energy[i], std::min(sizeof(word), m_energy.size() - i));
+		hash = (hash ^ word) * 1099511628211ULL;
+	}
+	return hash;
+}
+
+static void advance(OctopusGrid& grid, long num_steps, bool simd)
+{
+	for (long step = 0; step < num_steps; step++) {
+		if (simd) {
+			grid.step_simd();
+		} else {
+			grid.step();
 		}
 	}
 }
 
-int main()
+// Where the states of a grid start repeating
+struct Cycle {
+	long start;		// steps before the first state that repeats
+	long length;		// steps between repeats
+	long first_sync;	// first step where they all flash, -1 if never
+};
+
+// Brent's cycle detection, which only ever keeps two copies of the grid
+// besides the initial one. The hare is stepped one step at a time from the
+// start until it is at least one lap into the cycle, so it sees every state
+// there is and finds the first all flash step on the way. States are compared
+// by hash first, only matching hashes compare the whole grid.
+static Cycle find_cycle(const OctopusGrid& initial, bool simd)
 {
-	OctopusGrid grid;
+	Cycle cycle = {0, 1, -1};
+	OctopusGrid tortoise = initial;
+	OctopusGrid hare = initial;
+	advance(hare, 1, simd);
+	long hare_steps = 1;
+	if (hare.did_all_flash_together()) {
+		cycle.first_sync = hare_steps;
+	}
 
-	int row, col = 0;
-	std::ifstream input("../day11/input.txt");
-	for (std::string line; std::getline(input, line); ) {
-		col = 0;
-		for (char c: line) {
-			Octopus octopus;
-			octopus.energy_level = c - '0';
-			octopus.pos.row = row;
-			octopus.pos.col = col;
-			grid.add_octopus(octopus);
-			col++;
+	uint64_t tortoise_hash = tortoise.hash_state();
+	long power = 1;
+	while (hare.hash_state() != tortoise_hash || !hare.has_same_state(tortoise)) {
+		if (power == cycle.length) {
+			tortoise = hare;
+			tortoise_hash = tortoise.hash_state();
+			power *= 2;
+			cycle.length = 0;
+		}
+		advance(hare, 1, simd);
+		hare_steps++;
+		cycle.length++;
+		if (cycle.first_sync < 0 && hare.did_all_flash_together()) {
+			cycle.first_sync = hare_steps;
 		}
-		row++;
 	}
 
+	// Then walk two grids a cycle apart from the start until they meet at
+	// the start of the cycle
+	tortoise = initial;
+	hare = initial;
+	advance(hare, cycle.length, simd);
+	while (!hare.has_same_state(tortoise)) {
+		advance(tortoise, 1, simd);
+		advance(hare, 1, simd);
+		cycle.start++;
+	}
+
+	return cycle;
+}
+
+// Total number of flashes after num_steps steps, from at most
+// cycle.start + cycle.length steps of simulation
+static long count_flashes(const OctopusGrid& initial, const Cycle& cycle, long num_steps,
+			  bool simd)
+{
+	OctopusGrid grid = initial;
+	if (num_steps <= cycle.start + cycle.length) {
+		advance(grid, num_steps, simd);
+		return grid.get_num_flashes();
+	}
+
+	// num_steps = start + laps * length + rest
+	long laps = (num_steps - cycle.start) / cycle.length;
+	long rest = (num_steps - cycle.start) % cycle.length;
+	advance(grid, cycle.start, simd);
+	long flashes_before_cycle = grid.get_num_flashes();
+	advance(grid, rest, simd);
+	long flashes_with_rest = grid.get_num_flashes();
+	advance(grid, cycle.length - rest, simd);
+	long flashes_per_lap = grid.get_num_flashes() - flashes_before_cycle;
+	return flashes_with_rest + laps * flashes_per_lap;
+}
+
+// Steps BATCH_SIZE independent boards of the same size together. Each board
+// is one bit lane, and the energy level of a cell is split into bit planes:
+// bit k of the energy of every board's octopus at a cell is in planes[k] of
+// that cell. Energy saturates at FLASH_ENERGY so it fits in 4 planes. Boards
+// past the last one that was set up are all 0 and never affect the others.
+class alignas(VECTOR_WIDTH) OctopusBatch
+{
+public:
+	OctopusBatch(int num_rows, int num_cols);
+	void set_energy(int board, int row, int col, uint8_t energy);
+	void step(void);
+	long get_num_flashes(int board);
+	long get_first_sync(int board) { return m_first_sync[board]; }	// -1 if not yet
+private:
+	// First, so they are aligned like LaneCell
+	u64x4 m_step_count[COUNTER_BITS];	// flashes this step
+	u64x4 m_counters[COUNTER_BITS];		// flashes so far
+	u64x4 m_synced = {};
+	int m_num_rows;
+	int m_num_cols;
+	int m_stride;
+	int m_step_count_bits;			// enough for every cell to flash
+	long m_num_steps = 0;
+	std::vector<LaneCell> m_cells;
+	std::vector<long> m_first_sync;
+	size_t index(int row, int col) { return (row + 1) * m_stride + col + 1; }
+	__attribute__((always_inline)) inline void add_flashes(u64x4 *counter, int num_bits,
+							       const u64x4& bits);
+	__attribute__((always_inline)) inline void add_row_sums(int row);
+	__attribute__((always_inline)) inline void step_lanes(void);
+#if defined(__GNUC__) && defined(__x86_64__)
+	void step_lanes_avx2(void);
+#endif
+};
+
+static inline bool any_bits(const u64x4& v)
+{
+	return (v[0] | v[1] | v[2] | v[3]) != 0;
+}
+
+OctopusBatch::OctopusBatch(int num_rows, int num_cols)
+	: m_num_rows(num_rows), m_num_cols(num_cols), m_stride(num_cols + 2)
+{
+	size_t size = (num_rows + 2) * m_stride;
+	m_cells.assign(size, LaneCell());
+	memset(m_counters, 0, sizeof(m_counters));
+	m_step_count_bits = 1;
+	while ((1L << m_step_count_bits) <= (long)num_rows * num_cols) {
+		m_step_count_bits++;
+	}
+	m_first_sync.assign(BATCH_SIZE, -1);
+}
+
+void OctopusBatch::set_energy(int board, int row, int col, uint8_t energy)
+{
+	size_t i = index(row, col);
+	uint64_t bit = 1ULL << (board % 64);
+	for (int k = 0; k < 4; k++) {
+		if (energy & (1 << k)) {
+			m_cells[i].planes[k][board / 64] |= bit;
+		} else {
+			m_cells[i].planes[k][board / 64] &= ~bit;
+		}
+	}
+}
+
+long OctopusBatch::get_num_flashes(int board)
+{
+	long total = 0;
+	for (int k = 0; k < COUNTER_BITS; k++) {
+		total |= (long)((m_counters[k][board / 64] >> (board % 64)) & 1) << k;
+	}
+	return total;
+}
+
+// Adds carry (one bit per board) to a bit sliced counter
+void OctopusBatch::add_flashes(u64x4 *counter, int num_bits, const u64x4& bits)
+{
+	u64x4 carry = bits;
+	for (int k = 0; k < num_bits && any_bits(carry); k++) {
+		u64x4 next = counter[k] & carry;
+		counter[k] ^= carry;
+		carry = next;
+	}
+}
+
+// Marks a row's new flashes and adds up each run of three of them
+void OctopusBatch::add_row_sums(int row)
+{
+	for (size_t i = index(row, 0); i < index(row, m_num_cols); i++) {
+		m_cells[i].flashed |= m_cells[i].new_flashes;
+		u64x4 a = m_cells[i - 1].new_flashes;
+		u64x4 b = m_cells[i].new_flashes;
+		u64x4 c = m_cells[i + 1].new_flashes;
+		m_cells[i].row_sums[0] = a ^ b ^ c;
+		m_cells[i].row_sums[1] = (a & b) | (c & (a ^ b));
+	}
+}
+
+// Same rules as OctopusGrid::step(), for every board at once. Each sweep
+// adds up the new flashes around every cell with bit sliced adders: the sum
+// of the three cells in a row first, then the three row sums above, at and
+// below a cell. That sum includes the cell itself, which doesn't matter
+// because a cell that just flashed can't flash again this step.
+void OctopusBatch::step_lanes(void)
+{
+	const u64x4 zero = {};
+	const u64x4 ones = ~zero;
+
+	// First increase energy level of all octopuses by 1. Energy is at most 9
+	// after the last step, so it can only just get to FLASH_ENERGY (0b1010).
+	bool any_new = false;
+	for (int row = 0; row < m_num_rows; row++) {
+		for (size_t i = index(row, 0); i < index(row, m_num_cols); i++) {
+			u64x4 carry = ones;
+			for (auto& plane: m_cells[i].planes) {
+				u64x4 next = plane & carry;
+				plane ^= carry;
+				carry = next;
+			}
+			m_cells[i].flashed = zero;
+			any_new |= any_bits(m_cells[i].planes[3] & m_cells[i].planes[1]);
+		}
+	}
+
+	// Handle octopus flashes. Rows go top to bottom, and each one takes the
+	// flashes its row above had in this sweep, plus the ones it and the row
+	// below had in the last sweep, so every flash reaches each neighbor once.
+	// The new flashes and row sums are all zero between steps, so the first
+	// sweep just finds the octopuses that got to FLASH_ENERGY above.
+	while (any_new) {
+		any_new = false;
+		for (int row = 0; row < m_num_rows; row++) {
+			for (size_t i = index(row, 0); i < index(row, m_num_cols); i++) {
+				// Add the three 2 bit row sums into a 4 bit count
+				const u64x4 *above = m_cells[i - m_stride].row_sums;
+				const u64x4 *here = m_cells[i].row_sums;
+				const u64x4 *below = m_cells[i + m_stride].row_sums;
+				u64x4 a0 = above[0], a1 = above[1];
+				u64x4 b0 = here[0], b1 = here[1];
+				u64x4 c0 = below[0], c1 = below[1];
+				u64x4 n0 = a0 ^ b0 ^ c0;
+				u64x4 carry = (a0 & b0) | (c0 & (a0 ^ b0));
+				u64x4 x = a1 ^ b1 ^ c1;
+				u64x4 y = (a1 & b1) | (c1 & (a1 ^ b1));
+				u64x4 n1 = x ^ carry;
+				u64x4 n2 = y ^ (x & carry);
+				u64x4 n3 = y & x & carry;
+
+				// Then add the count to the energy, saturating at FLASH_ENERGY
+				u64x4 e0 = m_cells[i].planes[0], e1 = m_cells[i].planes[1];
+				u64x4 e2 = m_cells[i].planes[2], e3 = m_cells[i].planes[3];
+				u64x4 s0 = e0 ^ n0;
+				carry = e0 & n0;
+				u64x4 s1 = e1 ^ n1 ^ carry;
+				carry = (e1 & n1) | (carry & (e1 ^ n1));
+				u64x4 s2 = e2 ^ n2 ^ carry;
+				carry = (e2 & n2) | (carry & (e2 ^ n2));
+				u64x4 s3 = e3 ^ n3 ^ carry;
+				u64x4 s4 = (e3 & n3) | (carry & (e3 ^ n3));
+				u64x4 full = s4 | (s3 & (s2 | s1));
+				m_cells[i].planes[0] = s0 & ~full;
+				m_cells[i].planes[1] = s1 | full;
+				m_cells[i].planes[2] = s2 & ~full;
+				m_cells[i].planes[3] = s3 | full;
+
+				m_cells[i].new_flashes = full & ~m_cells[i].flashed;
+				any_new |= any_bits(m_cells[i].new_flashes);
+			}
+			add_row_sums(row);
+		}
+	}
+
+	// Count the flashes, check which boards all flashed at the same time and
+	// reset flashed octopuses back to 0
+	m_num_steps++;
+	u64x4 all_flashed = ones;
+	memset(m_step_count, 0, sizeof(m_step_count));
+	for (int row = 0; row < m_num_rows; row++) {
+		for (size_t i = index(row, 0); i < index(row, m_num_cols); i++) {
+			u64x4 flashed = m_cells[i].flashed;
+			add_flashes(m_step_count, m_step_count_bits, flashed);
+			all_flashed &= flashed;
+			for (auto& plane: m_cells[i].planes) {
+				plane &= ~flashed;
+			}
+		}
+	}
+
+	// Add each bit of the step's count at its weight
+	for (int k = 0; k < m_step_count_bits; k++) {
+		add_flashes(m_counters + k, COUNTER_BITS - k, m_step_count[k]);
+	}
+
+	u64x4 first_sync = all_flashed & ~m_synced;
+	m_synced |= all_flashed;
+	if (any_bits(first_sync)) {
+		for (int board = 0; board < BATCH_SIZE; board++) {
+			if ((first_sync[board / 64] >> (board % 64)) & 1) {
+				m_first_sync[board] = m_num_steps;
+			}
+		}
+	}
+}
+
+#if defined(__GNUC__) && defined(__x86_64__)
+__attribute__((target("avx2")))
+void OctopusBatch::step_lanes_avx2(void)
+{
+	step_lanes();
+}
+#endif
+
+void OctopusBatch::step(void)
+{
+#if defined(__GNUC__) && defined(__x86_64__)
+	if (__builtin_cpu_supports("avx2")) {
+		step_lanes_avx2();
+		return;
+	}
+#endif
+	step_lanes();
+}
+
+// Fills a grid with random energy levels
+static void generate_grid(OctopusGrid& grid, uint64_t& state)
+{
+	for (int row = 0; row < grid.get_num_rows(); row++) {
+		for (int col = 0; col < grid.get_num_cols(); col++) {
+			// xorshift64
+			state ^= state << 13;
+			state ^= state >> 7;
+			state ^= state << 17;
+			grid.set_energy(row, col, state % 10);
+		}
+	}
+}
+
+// Times num_steps steps of num_boards random boards, one OctopusGrid at a
+// time and BATCH_SIZE at a time with OctopusBatch, and checks they agree
+static int run_batch_benchmark(int num_rows, int num_cols, int num_boards, int num_steps)
+{
+	using clock = std::chrono::steady_clock;
+	std::vector<OctopusGrid> grids(num_boards, OctopusGrid(num_rows, num_cols));
+	uint64_t state = 0x9e3779b97f4a7c15ULL;
+	for (auto& grid: grids) {
+		generate_grid(grid, state);
+	}
+	printf("%d random %d x %d boards, %d steps\n", num_boards, num_rows, num_cols, num_steps);
+
+	// The batches start from copies of the boards, before any steps
+	int num_batches = (num_boards + BATCH_SIZE - 1) / BATCH_SIZE;
+	std::vector<OctopusBatch> batches(num_batches, OctopusBatch(num_rows, num_cols));
+	for (int board = 0; board < num_boards; board++) {
+		for (int row = 0; row < num_rows; row++) {
+			for (int col = 0; col < num_cols; col++) {
+				batches[board / BATCH_SIZE].set_energy(board % BATCH_SIZE, row, col,
+								       grids[board].get_energy(row, col));
+			}
+		}
+	}
+
+	std::vector<long> first_sync(num_boards, -1);
+	auto start = clock::now();
+	for (int board = 0; board < num_boards; board++) {
+		for (int step = 1; step <= num_steps; step++) {
+			grids[board].step();
+			if (first_sync[board] < 0 && grids[board].did_all_flash_together()) {
+				first_sync[board] = step;
+			}
+		}
+	}
+	double baseline = std::chrono::duration<double>(clock::now() - start).count();
+	printf("OctopusGrid   %8.3f s\n", baseline);
+
+	start = clock::now();
+	for (auto& batch: batches) {
+		for (int step = 0; step < num_steps; step++) {
+			batch.step();
+		}
+	}
+	double elapsed = std::chrono::duration<double>(clock::now() - start).count();
+	printf("OctopusBatch  %8.3f s  %5.2fx\n", elapsed, baseline / elapsed);
+
+	int num_synced = 0;
+	for (int board = 0; board < num_boards; board++) {
+		OctopusBatch& batch = batches[board / BATCH_SIZE];
+		if (batch.get_num_flashes(board % BATCH_SIZE) != grids[board].get_num_flashes() ||
+		    batch.get_first_sync(board % BATCH_SIZE) != first_sync[board]) {
+			printf("Mismatch on board %d!\n", board);
+			return 1;
+		}
+		num_synced += first_sync[board] >= 0;
+	}
+	printf("%d of %d boards all flashed together within %d steps\n", num_synced, num_boards,
+	       num_steps);
+
+	return 0;
+}
+
+// Trace sink that records nothing. run_steps() with it compiles down to the
+// plain step loop.
+struct NullTrace {
+	void record(long, OctopusGrid&) {}
+	bool failed(void) const { return false; }
+};
+
+// Start of a trace file, followed by the initial energy levels (one byte
+// each, padded to 8 bytes) and then one TraceEvent per step
+struct TraceHeader {
+	char magic[8];
+	uint32_t num_rows;
+	uint32_t num_cols;
+	uint32_t flags;
+	uint32_t event_size;	// TraceEvent plus the bitmap, if any
+	uint64_t num_events;
+};
+
+#define TRACE_MAGIC	"OCTTRACE"
+#define TRACE_BITMAPS	(1 << 0)	// events end in a bitmap of the flashed cells
+
+struct TraceEvent {
+	uint32_t step;
+	uint32_t num_flashes;
+	uint32_t cascade_depth;
+	uint32_t reserved;
+};
+
+// Trace sink that writes every step to a memory mapped file. Space for
+// events is allocated up front and doubled when it runs out, so recording a
+// step is a few stores into the mapping.
+class FileTrace
+{
+public:
+	~FileTrace() { finish(); }
+	int open(const char *path, OctopusGrid& grid, bool bitmaps, long expected_steps);
+	void record(long step, OctopusGrid& grid);
+	bool failed(void) const { return m_failed; }
+	int finish(void);
+private:
+	int m_fd = -1;
+	uint8_t *m_data = nullptr;
+	size_t m_size = 0;
+	size_t m_events_start = 0;
+	size_t m_event_size = 0;
+	uint64_t m_num_events = 0;
+	uint64_t m_capacity = 0;
+	bool m_bitmaps = false;
+	bool m_failed = false;		// ran out of space, the trace is incomplete
+	int resize(uint64_t capacity);
+};
+
+static size_t round_up_8(size_t n)
+{
+	return (n + 7) / 8 * 8;
+}
+
+int FileTrace::resize(uint64_t capacity)
+{
+	if (m_data) {
+		munmap(m_data, m_size);
+		m_data = nullptr;
+	}
+
+	m_size = m_events_start + capacity * m_event_size;
+	if (ftruncate(m_fd, m_size) != 0) {
+		printf("Failed to grow trace file.\n");
+		return -1;
+	}
+	void *data = mmap(nullptr, m_size, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, 0);
+	if (data == MAP_FAILED) {
+		printf("Failed to map trace file.\n");
+		return -1;
+	}
+
+	m_data = static_cast<uint8_t *>(data);
+	m_capacity = capacity;
+	return 0;
+}
+
+int FileTrace::open(const char *path, OctopusGrid& grid, bool bitmaps, long expected_steps)
+{
+	m_fd = ::open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (m_fd < 0) {
+		printf("Failed to create trace file %s.\n", path);
+		return -1;
+	}
+
+	size_t num_cells = (size_t)grid.get_num_rows() * grid.get_num_cols();
+	m_bitmaps = bitmaps;
+	m_events_start = sizeof(TraceHeader) + round_up_8(num_cells);
+	m_event_size = sizeof(TraceEvent) + (bitmaps ? round_up_8((num_cells + 7) / 8) : 0);
+	if (resize(std::max(expected_steps, 1L)) != 0) {
+		return -1;
+	}
+
+	TraceHeader header = {};
+	memcpy(header.magic, TRACE_MAGIC, sizeof(header.magic));
+	header.num_rows = grid.get_num_rows();
+	header.num_cols = grid.get_num_cols();
+	header.flags = bitmaps ? TRACE_BITMAPS : 0;
+	header.event_size = m_event_size;
+	memcpy(m_data, &header, sizeof(header));
+
+	uint8_t *energy = m_data + sizeof(TraceHeader);
+	for (int row = 0; row < grid.get_num_rows(); row++) {
+		for (int col = 0; col < grid.get_num_cols(); col++) {
+			*energy++ = grid.get_energy(row, col);
+		}
+	}
+	return 0;
+}
+
+void FileTrace::record(long step, OctopusGrid& grid)
+{
+	if (m_failed) {
+		return;
+	}
+	if (!m_data || (m_num_events == m_capacity && resize(2 * m_capacity) != 0)) {
+		m_failed = true;
+		return;
+	}
+
+	uint8_t *event = m_data + m_events_start + m_num_events * m_event_size;
+	TraceEvent e = {(uint32_t)step, (uint32_t)grid.get_step_flashes(),
+			(uint32_t)grid.get_cascade_depth(), 0};
+	memcpy(event, &e, sizeof(e));
+
+	if (m_bitmaps) {
+		uint8_t *bitmap = event + sizeof(TraceEvent);
+		memset(bitmap, 0, m_event_size - sizeof(TraceEvent));
+		size_t cell = 0;
+		for (int row = 0; row < grid.get_num_rows(); row++) {
+			for (int col = 0; col < grid.get_num_cols(); col++, cell++) {
+				if (grid.did_flash(row, col)) {
+					bitmap[cell / 8] |= 1 << (cell % 8);
+				}
+			}
+		}
+	}
+
+	m_num_events++;
+	memcpy(m_data + offsetof(TraceHeader, num_events), &m_num_events, sizeof(m_num_events));
+}
+
+// Trims the file to the events actually recorded. Returns -1 if recording
+// stopped early, since the trace is then missing steps.
+int FileTrace::finish(void)
+{
+	if (m_fd < 0) {
+		return 0;
+	}
+
+	int ret = 0;
+	if (m_data) {
+		munmap(m_data, m_size);
+		m_data = nullptr;
+	}
+	if (ftruncate(m_fd, m_events_start + m_num_events * m_event_size) != 0) {
+		printf("Failed to trim trace file.\n");
+		ret = -1;
+	}
+	if (m_failed) {
+		printf("Trace stopped after %lu steps.\n", (unsigned long)m_num_events);
+		ret = -1;
+	}
+	close(m_fd);
+	m_fd = -1;
+	return ret;
+}
+
+// Replays a trace file from its initial energy levels, printing the grid
+// after every step the way OctopusGrid::display() does. The replayed flashes
+// have to match the recorded ones.
+static int read_trace(const char *path)
+{
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		printf("Failed to open trace file %s.\n", path);
+		return -1;
+	}
+
+	struct stat st;
+	if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(TraceHeader)) {
+		printf("Trace file %s is too short.\n", path);
+		close(fd);
+		return -1;
+	}
+	size_t size = st.st_size;
+	void *data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED) {
+		printf("Failed to map trace file %s.\n", path);
+		return -1;
+	}
+	const uint8_t *bytes = static_cast<const uint8_t *>(data);
+
+	TraceHeader header;
+	memcpy(&header, bytes, sizeof(header));
+	size_t num_cells = (size_t)header.num_rows * header.num_cols;
+	size_t events_start = sizeof(TraceHeader) + round_up_8(num_cells);
+	size_t bitmap_size = (header.flags & TRACE_BITMAPS) ? round_up_8((num_cells + 7) / 8) : 0;
+	// Divide rather than multiply so a huge num_events can't wrap around
+	if (memcmp(header.magic, TRACE_MAGIC, sizeof(header.magic)) != 0 ||
+	    header.event_size < sizeof(TraceEvent) + bitmap_size ||
+	    events_start > size ||
+	    header.num_events > (size - events_start) / header.event_size) {
+		printf("%s is not a valid trace file.\n", path);
+		munmap(data, size);
+		return -1;
+	}
+
+	OctopusGrid grid(header.num_rows, header.num_cols);
+	const uint8_t *energy = bytes + sizeof(TraceHeader);
+	for (uint32_t row = 0; row < header.num_rows; row++) {
+		for (uint32_t col = 0; col < header.num_cols; col++) {
+			grid.set_energy(row, col, *energy++);
+		}
+	}
+	printf("Before any steps:\n");
+	grid.display();
+
+	int ret = 0;
+	for (uint64_t n = 0; n < header.num_events && ret == 0; n++) {
+		const uint8_t *event = bytes + events_start + n * header.event_size;
+		TraceEvent e;
+		memcpy(&e, event, sizeof(e));
+
+		grid.step();
+		if (grid.get_step_flashes() != e.num_flashes) {
+			ret = -1;
+		}
+		if (header.flags & TRACE_BITMAPS) {
+			const uint8_t *bitmap = event + sizeof(TraceEvent);
+			size_t cell = 0;
+			for (uint32_t row = 0; row < header.num_rows; row++) {
+				for (uint32_t col = 0; col < header.num_cols; col++, cell++) {
+					if (grid.did_flash(row, col) != ((bitmap[cell / 8] >> (cell % 8)) & 1)) {
+						ret = -1;
+					}
+				}
+			}
+		}
+		if (ret != 0) {
+			printf("Step %u doesn't match the trace.\n", e.step);
+			break;
+		}
+
+		printf("After step %u: %u flashes, cascade depth %u\n", e.step, e.num_flashes,
+		       e.cascade_depth);
+		grid.display();
+	}
+
+	munmap(data, size);
+	return ret;
+}
+
+// Steps until all the octopuses flash together, printing both parts and
+// passing every step to trace.record(). Returns -1 if the trace fails.
+template <typename Trace>
+static int run_steps(OctopusGrid& grid, int num_threads, bool simd, Trace& trace)
+{
 	int step = 0;
 	while (!grid.did_all_flash_together()) {
-		grid.step();
-		if (++step == 100) {
-			printf("Part 1: %d\n", grid.get_num_flashes());
+		if (num_threads > 0) {
+			grid.step_parallel(num_threads);
+		} else if (simd) {
+			grid.step_simd();
+		} else {
+			grid.step();
+		}
+		trace.record(++step, grid);
+		if (trace.failed()) {
+			return -1;
+		}
+		if (step == 100) {
+			printf("Part 1: %ld\n", grid.get_num_flashes());
 		}
 	}
 
 	printf("Part 2: %d\n", step);
 	return 0;
 }
+
+int main(int argc, char *argv[])
+{
+	const char *input_path = "../day11/input.txt";
+	bool simd = false;
+	int num_threads = 0;
+	long num_steps = 0;
+	const char *trace_path = nullptr;
+	bool trace_bitmaps = false;
+	bool batch_benchmark = false;
+	int bench_boards = 25600;
+	int bench_steps = 500;
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--simd") == 0) {
+			simd = true;
+		} else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+			num_threads = atoi(argv[++i]);
+			if (num_threads <= 0) {
+				printf("Invalid number of threads %s.\n", argv[i]);
+				return 1;
+			}
+		} else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc) {
+			trace_path = argv[++i];
+		} else if (strcmp(argv[i], "--trace-bitmaps") == 0) {
+			trace_bitmaps = true;
+		} else if (strcmp(argv[i], "--read-trace") == 0 && i + 1 < argc) {
+			return read_trace(argv[++i]) == 0 ? 0 : 1;
+		} else if (strcmp(argv[i], "--batch-bench") == 0) {
+			batch_benchmark = true;
+			if (i + 2 < argc && isdigit(argv[i + 1][0]) && isdigit(argv[i + 2][0])) {
+				bench_boards = atoi(argv[++i]);
+				bench_steps = atoi(argv[++i]);
+			}
+		} else if (strcmp(argv[i], "--steps") == 0 && i + 1 < argc) {
+			num_steps = strtol(argv[++i], nullptr, 10);
+			if (num_steps <= 0) {
+				printf("Invalid number of steps %s.\n", argv[i]);
+				return 1;
+			}
+		} else {
+			input_path = argv[i];
+		}
+	}
+
+	std::ifstream input(input_path);
+	if (!input) {
+		printf("Failed to open input file.\n");
+		return 1;
+	}
+
+	// Read the lines first so the grid can be sized to fit them
+	std::vector<std::string> lines;
+	for (std::string line; std::getline(input, line); ) {
+		if (!line.empty() && line.back() == '\r') {
+			line.pop_back();
+		}
+		if (!line.empty()) {
+			lines.push_back(line);
+		}
+	}
+	if (lines.empty()) {
+		printf("Input file is empty.\n");
+		return 1;
+	}
+
+	OctopusGrid grid(lines.size(), lines[0].length());
+	for (size_t row = 0; row < lines.size(); row++) {
+		if (lines[row].length() != lines[0].length()) {
+			printf("Line %zu has %zu octopuses, expected %zu.\n", row + 1,
+			       lines[row].length(), lines[0].length());
+			return 1;
+		}
+		for (size_t col = 0; col < lines[row].length(); col++) {
+			grid.set_energy(row, col, lines[row][col] - '0');
+		}
+	}
+
+	// Random boards the size of the input, stepped one at a time and in
+	// batches
+	if (batch_benchmark) {
+		return run_batch_benchmark(grid.get_num_rows(), grid.get_num_cols(), bench_boards,
+					   bench_steps);
+	}
+
+	// Skip ahead to any step once the states start repeating
+	if (num_steps > 0) {
+		Cycle cycle = find_cycle(grid, simd);
+		printf("States repeat every %ld steps from step %ld.\n", cycle.length, cycle.start);
+		printf("Flashes after %ld steps: %ld\n", num_steps,
+		       count_flashes(grid, cycle, num_steps, simd));
+		if (cycle.first_sync < 0) {
+			printf("They never all flash together.\n");
+		} else {
+			printf("First step where they all flash: %ld\n", cycle.first_sync);
+		}
+		return 0;
+	}
+
+	if (trace_path) {
+		FileTrace trace;
+		if (trace.open(trace_path, grid, trace_bitmaps, 1024) != 0) {
+			return 1;
+		}
+		int ret = run_steps(grid, num_threads, simd, trace);
+		if (trace.finish() != 0 || ret != 0) {
+			return 1;
+		}
+	} else {
+		NullTrace trace;
+		run_steps(grid, num_threads, simd, trace);
+	}
+
+	return 0;
+}
@@ -1,69 +1,843 @@
 #include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <cstring>
 #include <vector>
 #include <algorithm>
-#include <math.h>
+#include <chrono>
+#include <thread>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
 
-int main()
+// 32 byte lanes, lowered to whatever vector registers the target has
+typedef uint8_t u8x32 __attribute__((vector_size(32)));
+
+// Number of crabs at each position, offset by the smallest position seen, plus
+// the prefix sums needed to work out the fuel cost of any alignment in O(1).
+struct CrabHistogram {
+	int min_pos = 0;
+	long num_crabs = 0;
+	long total_sum = 0;		// sum of all offsets
+	long total_sum_of_squares = 0;	// sum of all squared offsets
+	std::vector<long> counts;	// counts[i] is the number of crabs at min_pos + i
+	std::vector<long> prefix_count;	// number of crabs with an offset < i
+	std::vector<long> prefix_sum;	// sum of the offsets that are < i
+};
+
+// Where to align the crabs and how much fuel it takes to get there
+struct Alignment {
+	int position;
+	long fuel;
+};
+
+// Recomputes the prefix sums after crabs were added, trimming empty positions
+// left over from growing the range.
+static void compute_prefix_sums(CrabHistogram& hist)
 {
-	int num = 0;
-	std::vector<int> values;
+	auto first = std::find_if(hist.counts.begin(), hist.counts.end(),
+				  [](long count) { return count != 0; });
+	hist.min_pos += first - hist.counts.begin();
+	hist.counts.erase(hist.counts.begin(), first);
+	while (!hist.counts.empty() && hist.counts.back() == 0) {
+		hist.counts.pop_back();
+	}
+
+	size_t range = hist.counts.size();
+	hist.prefix_count.assign(range + 1, 0);
+	hist.prefix_sum.assign(range + 1, 0);
+	hist.total_sum_of_squares = 0;
+	for (size_t i = 0; i < range; i++) {
+		long count = hist.counts[i];
+		long offset = i;
+		hist.prefix_count[i + 1] = hist.prefix_count[i] + count;
+		hist.prefix_sum[i + 1] = hist.prefix_sum[i] + count * offset;
+		hist.total_sum_of_squares += count * offset * offset;
+	}
+	hist.num_crabs = hist.prefix_count[range];
+	hist.total_sum = hist.prefix_sum[range];
+}
+
+// Adds a single crab, growing the position range in either direction as needed.
+// compute_prefix_sums() has to be called before looking up any fuel costs.
+static void add_crab(CrabHistogram& hist, int pos)
+{
+	if (hist.counts.empty()) {
+		hist.min_pos = pos;
+		hist.counts.push_back(0);
+	}
+
+	if (pos < hist.min_pos) {
+		size_t grow = std::max<size_t>(hist.min_pos - pos, hist.counts.size());
+		hist.counts.insert(hist.counts.begin(), grow, 0);
+		hist.min_pos -= grow;
+	}
+
+	size_t offset = pos - hist.min_pos;
+	if (offset >= hist.counts.size()) {
+		hist.counts.resize(std::max(offset + 1, hist.counts.size() * 2), 0);
+	}
+	hist.counts[offset]++;
+}
+
+// Part 1 - each step costs 1 fuel, so the cost is the sum of distances to the
+// alignment offset. Crabs to the left and right are summed separately.
+static long linear_fuel(const CrabHistogram& hist, long offset)
+{
+	long num_left = hist.prefix_count[offset];
+	long sum_left = hist.prefix_sum[offset];
+	long num_right = hist.num_crabs - num_left;
+	long sum_right = hist.total_sum - sum_left;
+	return (offset * num_left - sum_left) + (sum_right - offset * num_right);
+}
+
+// Part 2 - moving d steps costs 1 + 2 + ... + d = (d^2 + d) / 2, and the sum of
+// squared distances expands to totals that don't depend on the crab positions.
+static long triangular_fuel(const CrabHistogram& hist, long offset)
+{
+	long sum_of_squares = hist.total_sum_of_squares - 2 * offset * hist.total_sum +
+			      offset * offset * hist.num_crabs;
+	return (sum_of_squares + linear_fuel(hist, offset)) / 2;
+}
+
+// Fuel cost policies. fuel(distance) is what a single crab pays to move that
+// far. Policies with a closed form also provide total(hist, offset), the fuel for
+// every crab at once; the others are searched by brute force.
+struct LinearCost {
+	static constexpr bool has_closed_form = true;
+	static long fuel(long distance) { return distance; }
+	static long total(const CrabHistogram& hist, long offset)
+	{
+		return linear_fuel(hist, offset);
+	}
+};
+
+struct TriangularCost {
+	static constexpr bool has_closed_form = true;
+	static long fuel(long distance) { return distance * (distance + 1) / 2; }
+	static long total(const CrabHistogram& hist, long offset)
+	{
+		return triangular_fuel(hist, offset);
+	}
+};
+
+// Short hops burn fuel quadratically, but long trips get a flat rate per step
+// after the first 8. The cost isn't convex so there's no shortcut to the minimum.
+struct BulkDiscountCost {
+	static constexpr bool has_closed_form = false;
+	static long fuel(long distance)
+	{
+		return distance <= 8 ? distance * distance : 64 + (distance - 8);
+	}
+};
+
+// Sum of a[i] * b[i], the inner loop of the brute force search
+static long dot_product(const long *a, const long *b, long n)
+{
+	long total = 0;
+	for (long i = 0; i < n; i++) {
+		total += a[i] * b[i];
+	}
+	return total;
+}
+
+#if defined(__GNUC__) && defined(__x86_64__)
+// Same as dot_product, 4 lanes at a time. AVX2 has no 64 bit multiply so the low
+// half of each product is assembled from 32 bit multiplies of the halves.
+__attribute__((target("avx2")))
+static long dot_product_avx2(const long *a, const long *b, long n)
+{
+	__m256i acc = _mm256_setzero_si256();
+	long i = 0;
+	for (; i + 4 <= n; i += 4) {
+		__m256i va = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(a + i));
+		__m256i vb = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(b + i));
+		__m256i cross = _mm256_add_epi64(_mm256_mul_epu32(va, _mm256_srli_epi64(vb, 32)),
+						 _mm256_mul_epu32(_mm256_srli_epi64(va, 32), vb));
+		__m256i product = _mm256_add_epi64(_mm256_mul_epu32(va, vb),
+						   _mm256_slli_epi64(cross, 32));
+		acc = _mm256_add_epi64(acc, product);
+	}
+
+	long lanes[4];
+	_mm256_storeu_si256(reinterpret_cast<__m256i *>(lanes), acc);
+	return lanes[0] + lanes[1] + lanes[2] + lanes[3] + dot_product(a + i, b + i, n - i);
+}
+#endif
+
+// Evaluates the cost of every offset by multiplying the crab counts with a
+// table of per distance costs. Crabs left of the offset use the reversed counts
+// so both halves are contiguous dot products. The offsets are split across
+// threads, and ties go to the lowest offset so the result matches a sequential
+// scan.
+template <typename Cost>
+static Alignment brute_force_min_fuel(const CrabHistogram& hist, int num_threads)
+{
+	long range = hist.counts.size();
+	std::vector<long> costs(range);
+	for (long distance = 0; distance < range; distance++) {
+		costs[distance] = Cost::fuel(distance);
+	}
+	std::vector<long> reversed_counts(hist.counts.rbegin(), hist.counts.rend());
+
+	long (*dot)(const long *, const long *, long) = dot_product;
+#if defined(__GNUC__) && defined(__x86_64__)
+	if (__builtin_cpu_supports("avx2")) {
+		dot = dot_product_avx2;
+	}
+#endif
+
+	num_threads = std::max(1L, std::min<long>(num_threads, range));
+	std::vector<Alignment> best(num_threads);
+	std::vector<std::thread> threads;
+	for (int t = 0; t < num_threads; t++) {
+		threads.emplace_back([&, t]() {
+			long start = range * t / num_threads;
+			long end = range * (t + 1) / num_threads;
+			Alignment local_best = {0, -1};
+			for (long offset = start; offset < end; offset++) {
+				long fuel = dot(reversed_counts.data() + (range - offset),
+						costs.data() + 1, offset) +
+					    dot(hist.counts.data() + offset, costs.data(), range - offset);
+				if (local_best.fuel < 0 || fuel < local_best.fuel) {
+					local_best = {(int)(hist.min_pos + offset), fuel};
+				}
+			}
+			best[t] = local_best;
+		});
+	}
+	for (auto& thread: threads) {
+		thread.join();
+	}
+
+	return *std::min_element(best.begin(), best.end(),
+				 [](const Alignment& a, const Alignment& b) {
+		return a.fuel < b.fuel;
+	});
+}
+
+// Exact minimum over every position between the outermost crabs. Costs with a
+// closed form are scanned in O(range), the rest fall back to brute force.
+template <typename Cost>
+static Alignment find_min_fuel(const CrabHistogram& hist, bool force_brute_force = false)
+{
+	if constexpr (Cost::has_closed_form) {
+		if (!force_brute_force) {
+			Alignment best = {hist.min_pos, Cost::total(hist, 0)};
+			for (long offset = 1; offset < (long)hist.counts.size(); offset++) {
+				long total_fuel = Cost::total(hist, offset);
+				if (total_fuel < best.fuel) {
+					best.position = hist.min_pos + offset;
+					best.fuel = total_fuel;
+				}
+			}
+			return best;
+		}
+	}
+
+	int num_threads = std::max(1u, std::thread::hardware_concurrency());
+	return brute_force_min_fuel<Cost>(hist, num_threads);
+}
+
+// Running summary of crab positions for streamed input. Counts and offset sums
+// live in Fenwick trees over the position range, so adding a crab and finding
+// the best alignments are O(log range) and no positions are kept around.
+class CrabStream
+{
+public:
+	void add_crab(int pos);
+	long get_num_crabs(void) { return m_num_crabs; }
+
+	// Part 1 - the median is an optimal alignment for linear fuel usage
+	Alignment best_linear_alignment(void);
+
+	// Part 2 - the optimum for triangular fuel usage is within 1/2 of the mean
+	Alignment best_triangular_alignment(void);
+private:
+	int m_min_pos = 0;
+	long m_num_crabs = 0;
+	long m_total_sum = 0;			// sum of all offsets from m_min_pos
+	long m_total_sum_of_squares = 0;	// sum of all squared offsets
+	std::vector<long> m_counts;		// m_counts[i] is the number of crabs at m_min_pos + i
+	std::vector<long> m_count_tree;		// Fenwick tree over m_counts
+	std::vector<long> m_sum_tree;		// Fenwick tree over m_counts[i] * i
+
+	// Moves the range so it covers pos, then rebuilds the trees
+	void grow_range(int pos);
+
+	// Number of crabs and sum of their offsets for offsets < offset
+	void query_prefix(long offset, long& count, long& sum);
+
+	// Smallest offset that has more than k crabs at or before it
+	long find_kth_offset(long k);
+
+	long linear_fuel(long offset);
+	long triangular_fuel(long offset);
+};
+
+void CrabStream::grow_range(int pos)
+{
+	if (m_counts.empty()) {
+		m_min_pos = pos;
+		m_counts.assign(1024, 0);
+	}
+
+	if (pos < m_min_pos) {
+		long shift = std::max<long>(m_min_pos - pos, m_counts.size());
+		m_counts.insert(m_counts.begin(), shift, 0);
+		m_min_pos -= shift;
+
+		// Every offset grows by shift, so the totals have to be rebased
+		m_total_sum_of_squares += 2 * shift * m_total_sum + shift * shift * m_num_crabs;
+		m_total_sum += shift * m_num_crabs;
+	}
+
+	size_t offset = pos - m_min_pos;
+	if (offset >= m_counts.size()) {
+		m_counts.resize(std::max(offset + 1, m_counts.size() * 2), 0);
+	}
+
+	// Linear time Fenwick construction, each node pushes its total to its parent
+	size_t range = m_counts.size();
+	m_count_tree.assign(range + 1, 0);
+	m_sum_tree.assign(range + 1, 0);
+	for (size_t i = 1; i <= range; i++) {
+		m_count_tree[i] += m_counts[i - 1];
+		m_sum_tree[i] += m_counts[i - 1] * (long)(i - 1);
+		size_t parent = i + (i & -i);
+		if (parent <= range) {
+			m_count_tree[parent] += m_count_tree[i];
+			m_sum_tree[parent] += m_sum_tree[i];
+		}
+	}
+}
+
+void CrabStream::add_crab(int pos)
+{
+	if (m_counts.empty() || pos < m_min_pos ||
+	    pos - m_min_pos >= (long)m_counts.size()) {
+		grow_range(pos);
+	}
+
+	long offset = pos - m_min_pos;
+	m_counts[offset]++;
+	m_num_crabs++;
+	m_total_sum += offset;
+	m_total_sum_of_squares += offset * offset;
+	for (size_t i = offset + 1; i < m_count_tree.size(); i += i & -i) {
+		m_count_tree[i]++;
+		m_sum_tree[i] += offset;
+	}
+}
+
+void CrabStream::query_prefix(long offset, long& count, long& sum)
+{
+	count = 0;
+	sum = 0;
+	for (long i = std::min<long>(offset, m_counts.size()); i > 0; i -= i & -i) {
+		count += m_count_tree[i];
+		sum += m_sum_tree[i];
+	}
+}
+
+long CrabStream::find_kth_offset(long k)
+{
+	// Walk down the tree one power of two at a time
+	long pos = 0;
+	long step = 1;
+	while (step * 2 <= (long)m_counts.size()) {
+		step *= 2;
+	}
+	for (; step > 0; step /= 2) {
+		if (pos + step <= (long)m_counts.size() && m_count_tree[pos + step] <= k) {
+			pos += step;
+			k -= m_count_tree[pos];
+		}
+	}
+
+	return pos;
+}
+
+long CrabStream::linear_fuel(long offset)
+{
+	long num_left, sum_left;
+	query_prefix(offset, num_left, sum_left);
+	long num_right = m_num_crabs - num_left;
+	long sum_right = m_total_sum - sum_left;
+	return (offset * num_left - sum_left) + (sum_right - offset * num_right);
+}
+
+long CrabStream::triangular_fuel(long offset)
+{
+	long sum_of_squares = m_total_sum_of_squares - 2 * offset * m_total_sum +
+			      offset * offset * m_num_crabs;
+	return (sum_of_squares + linear_fuel(offset)) / 2;
+}
+
+Alignment CrabStream::best_linear_alignment(void)
+{
+	long median = find_kth_offset(m_num_crabs / 2);
+	return {(int)(m_min_pos + median), linear_fuel(median)};
+}
+
+Alignment CrabStream::best_triangular_alignment(void)
+{
+	// The cost is convex and its real valued minimum is within 1/2 of the
+	// mean, so the integer minimum is one of the four offsets around it
+	long mean = m_total_sum / m_num_crabs;
+	Alignment best = {0, -1};
+	for (long offset = std::max(mean - 1, 0L); offset <= mean + 2; offset++) {
+		long fuel = triangular_fuel(offset);
+		if (best.fuel < 0 || fuel < best.fuel) {
+			best.position = m_min_pos + offset;
+			best.fuel = fuel;
+		}
+	}
+
+	return best;
+}
+
+static bool is_digit(char c)
+{
+	return c >= '0' && c <= '9';
+}
+
+// Number of leading ASCII digits in 8 bytes loaded little endian. A byte is a
+// digit when it is <= 9 after xor'ing with '0'; masking off the top bit before
+// the add keeps the carries from spilling into the neighboring byte.
+static int count_leading_digits(uint64_t chunk)
+{
+	uint64_t x = chunk ^ 0x3030303030303030ULL;
+	uint64_t non_digits = (((x & 0x7f7f7f7f7f7f7f7fULL) + 0x7676767676767676ULL) | x) &
+			      0x8080808080808080ULL;
+	if (non_digits == 0) {
+		return 8;
+	}
+	return __builtin_ctzll(non_digits) / 8;
+}
+
+// Converts the first num_digits (1-7) ASCII digits of chunk in one go by
+// combining neighboring digits, then pairs, then quads with multiplies.
+static uint32_t decode_digits(uint64_t chunk, int num_digits)
+{
+	// Shift the digits to the top so the unused low bytes act as leading zeros
+	uint64_t val = (chunk & 0x0f0f0f0f0f0f0f0fULL) << (8 * (8 - num_digits));
+	val = (val * 10 + (val >> 8)) & 0x00ff00ff00ff00ffULL;
+	val = (val * 100 + (val >> 16)) & 0x0000ffff0000ffffULL;
+	val = (val * 10000 + (val >> 32)) & 0x00000000ffffffffULL;
+	return val;
+}
+
+// Scalar fallback for numbers that are too long or too close to the end of the
+// buffer for the 8 byte loads. Returns false if there were no digits.
+static bool parse_int(const char *p, const char *end, int& value)
+{
+	bool negative = (p < end && *p == '-');
+	if (negative) {
+		p++;
+	}
+
+	if (p == end || !is_digit(*p)) {
+		return false;
+	}
+
+	long num = 0;
+	for (; p < end && is_digit(*p); p++) {
+		num = num * 10 + (*p - '0');
+	}
+	value = negative ? -num : num;
+	return true;
+}
+
+// Parses integers separated by commas or whitespace. The input can be handed
+// over in chunks of any size; a number split across two chunks is carried over
+// to the next feed() call.
+class IntListParser
+{
+public:
+	// Passes every complete integer in the chunk to sink(int)
+	template <typename Sink>
+	void feed(const char *data, size_t len, Sink&& sink);
 
-	FILE *fp = fopen("../day7/input.txt", "r");
+	// Flushes a trailing integer that wasn't followed by a separator
+	template <typename Sink>
+	void finish(Sink&& sink);
+private:
+	char m_carry[32];
+	size_t m_carry_len = 0;
+
+	// Parses [p, end) and returns the start of an unterminated trailing number
+	template <typename Sink>
+	const char *parse_span(const char *p, const char *end, Sink&& sink);
+};
+
+template <typename Sink>
+const char *IntListParser::parse_span(const char *p, const char *end, Sink&& sink)
+{
+	while (p < end) {
+		if (!is_digit(*p) && *p != '-') {
+			p++;
+			continue;
+		}
+
+		const char *start = p;
+		bool negative = (*p == '-');
+		if (negative) {
+			p++;
+		}
+
+		// Fast path, the whole number and its separator are in the next 8 bytes
+		if (end - p >= 8) {
+			uint64_t chunk;
+			memcpy(&chunk, p, sizeof(chunk));
+			int num_digits = count_leading_digits(chunk);
+			if (num_digits > 0 && num_digits < 8) {
+				int value = decode_digits(chunk, num_digits);
+				sink(negative ? -value : value);
+				p += num_digits;
+				continue;
+			}
+		}
+
+		while (p < end && is_digit(*p)) {
+			p++;
+		}
+		if (p == end) {
+			return start;
+		}
+
+		int value;
+		if (parse_int(start, p, value)) {
+			sink(value);
+		}
+	}
+
+	return end;
+}
+
+template <typename Sink>
+void IntListParser::feed(const char *data, size_t len, Sink&& sink)
+{
+	const char *p = data;
+	const char *end = data + len;
+
+	// Complete the number left over from the previous chunk first
+	if (m_carry_len > 0) {
+		while (p < end && is_digit(*p) && m_carry_len < sizeof(m_carry)) {
+			m_carry[m_carry_len++] = *p++;
+		}
+		if (p == end) {
+			return;
+		}
+		finish(sink);
+	}
+
+	const char *rest = parse_span(p, end, sink);
+	m_carry_len = std::min<size_t>(end - rest, sizeof(m_carry));
+	memcpy(m_carry, rest, m_carry_len);
+}
+
+template <typename Sink>
+void IntListParser::finish(Sink&& sink)
+{
+	int value;
+	if (m_carry_len > 0 && parse_int(m_carry, m_carry + m_carry_len, value)) {
+		sink(value);
+	}
+	m_carry_len = 0;
+}
+
+// Counts occurrences of c 32 bytes at a time, used to size the output up front
+static size_t count_char(const char *data, size_t len, char c)
+{
+	size_t count = 0;
+	size_t i = 0;
+	while (i + 32 <= len) {
+		// A match compares as all ones, so subtracting it counts the lane
+		// up by one. Flush after 255 blocks, before the lanes can wrap.
+		u8x32 lane_counts = {};
+		for (int block = 0; block < 255 && i + 32 <= len; block++, i += 32) {
+			u8x32 bytes;
+			memcpy(&bytes, data + i, sizeof(bytes));
+			lane_counts -= (u8x32)(bytes == (uint8_t)c);
+		}
+		for (int lane = 0; lane < 32; lane++) {
+			count += lane_counts[lane];
+		}
+	}
+	for (; i < len; i++) {
+		count += (data[i] == c);
+	}
+
+	return count;
+}
+
+// Maps the whole input file read only. Returns nullptr on error.
+static const char *map_file(const char *path, size_t& size)
+{
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		printf("Failed to open input file %s.\n", path);
+		return nullptr;
+	}
+
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size == 0) {
+		printf("Input file %s is empty or can't be read.\n", path);
+		close(fd);
+		return nullptr;
+	}
+
+	size = st.st_size;
+	void *data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED) {
+		printf("Failed to map input file %s.\n", path);
+		return nullptr;
+	}
+	madvise(data, size, MADV_SEQUENTIAL);
+
+	return static_cast<const char *>(data);
+}
+
+// Feeds a file descriptor that can't be mapped (stdin, pipes) through the parser
+// a fixed size chunk at a time
+template <typename Sink>
+static int parse_stream(int fd, Sink&& sink)
+{
+	static char buf[1 << 20];
+	IntListParser parser;
+	ssize_t len;
+	while ((len = read(fd, buf, sizeof(buf))) != 0) {
+		if (len < 0) {
+			printf("Failed to read input.\n");
+			return -1;
+		}
+		parser.feed(buf, len, sink);
+	}
+	parser.finish(sink);
+
+	return 0;
+}
+
+// Original parser, kept as the baseline for the benchmark
+static int read_positions_fscanf(const char *path, std::vector<int>& values)
+{
+	int num = 0;
+	FILE *fp = fopen(path, "r");
 	if (!fp) {
 		printf("Failed to open input file.\n");
-		return 1;
+		return -1;
 	}
 	while (fscanf(fp, "%d,", &num) > 0) {
 		values.push_back(num);
 	}
 	fclose(fp);
-	std::sort(values.begin(), values.end());
-
-	// Part 1 - the majority are near the median so for linear fuel usage
-	// that's the most efficient reference
-	int total_fuel = 0;
-	int median = values[values.size() / 2];
-	for (auto val: values) {
-		if (val > median) {
-			total_fuel += (val - median);
-		} else {
-			total_fuel += (median - val);
-		}
-	}
-	printf("Part 1, total fuel: %d\n", total_fuel);
-
-	// Part 2 - the mean is the mid point so less fuel is used for exponential steps away
-	int mean = 0;
-	for (auto val: values) {
-		mean += val;
-	}
-	mean = round((float)mean / values.size());
-
-	// The mean itself is sometimes not the correct answer, so test around the mean
-	// to find the lowest fuel cost and use that
-	int total_fuels[3];
-	int idx = 0;
-	for (int i = mean - 1; i <= mean + 1; i++) {
-		total_fuel = 0;
-		for (auto val: values) {
-			int num_steps = 0;
-			if (val > i) {
-				num_steps = val - i;
-			} else {
-				num_steps = i - val;
-			}
 
-			int fuel_for_steps = 0;
-			for (int j = 1; j <= num_steps; j++) {
-				fuel_for_steps += j;
+	return 0;
+}
+
+static int read_positions(const char *path, std::vector<int>& values)
+{
+	size_t size;
+	const char *data = map_file(path, size);
+	if (!data) {
+		return -1;
+	}
+
+	values.reserve(values.size() + count_char(data, size, ',') + 1);
+	IntListParser parser;
+	auto sink = [&values](int pos) { values.push_back(pos); };
+	parser.feed(data, size, sink);
+	parser.finish(sink);
+	munmap(const_cast<char *>(data), size);
+
+	return 0;
+}
+
+// Feeds every integer in the input to sink(int). A path of "-" reads from stdin.
+template <typename Sink>
+static int parse_input(const char *path, Sink&& sink)
+{
+	if (strcmp(path, "-") == 0) {
+		return parse_stream(STDIN_FILENO, sink);
+	}
+
+	size_t size;
+	const char *data = map_file(path, size);
+	if (!data) {
+		return -1;
+	}
+
+	IntListParser parser;
+	parser.feed(data, size, sink);
+	parser.finish(sink);
+	munmap(const_cast<char *>(data), size);
+
+	return 0;
+}
+
+// Parses straight into the histogram without an intermediate vector
+static int read_positions(const char *path, CrabHistogram& hist)
+{
+	if (parse_input(path, [&hist](int pos) { add_crab(hist, pos); }) != 0) {
+		return -1;
+	}
+
+	if (hist.counts.empty()) {
+		printf("%s: no crab positions.\n", __func__);
+		return -1;
+	}
+	compute_prefix_sums(hist);
+
+	return 0;
+}
+
+static void print_stream_report(CrabStream& stream)
+{
+	Alignment part1 = stream.best_linear_alignment();
+	Alignment part2 = stream.best_triangular_alignment();
+	printf("%ld crabs - Part 1: position %d, fuel %ld - Part 2: position %d, fuel %ld\n",
+	       stream.get_num_crabs(), part1.position, part1.fuel, part2.position,
+	       part2.fuel);
+}
+
+// Reports the current answers every report_interval crabs as they arrive
+static int run_stream(const char *path, long report_interval)
+{
+	CrabStream stream;
+	int ret = parse_input(path, [&stream, report_interval](int pos) {
+		stream.add_crab(pos);
+		if (stream.get_num_crabs() % report_interval == 0) {
+			print_stream_report(stream);
+		}
+	});
+	if (ret != 0) {
+		return 1;
+	}
+
+	if (stream.get_num_crabs() == 0) {
+		printf("%s: no crab positions.\n", __func__);
+		return 1;
+	}
+
+	if (stream.get_num_crabs() % report_interval != 0) {
+		print_stream_report(stream);
+	}
+	return 0;
+}
+
+// Runs a parser repeatedly for at least half a second and prints its throughput.
+// parse() returns the number of values it parsed, or -1 on error.
+template <typename Parse>
+static int benchmark_parser(const char *name, size_t file_size, Parse&& parse)
+{
+	using clock = std::chrono::steady_clock;
+	long num_values = 0;
+	long iterations = 0;
+	double elapsed = 0;
+	auto start = clock::now();
+	do {
+		num_values = parse();
+		if (num_values < 0) {
+			return -1;
+		}
+		iterations++;
+		elapsed = std::chrono::duration<double>(clock::now() - start).count();
+	} while (elapsed < 0.5);
+
+	double gb_per_sec = (double)file_size * iterations / elapsed / 1e9;
+	printf("%-22s %8.3f GB/s  (%ld values, %ld iterations)\n", name, gb_per_sec,
+	       num_values, iterations);
+	return 0;
+}
+
+static int run_parse_benchmark(const char *path)
+{
+	struct stat st;
+	if (stat(path, &st) != 0) {
+		printf("Failed to open input file %s.\n", path);
+		return 1;
+	}
+	size_t file_size = st.st_size;
+	printf("Parsing %s (%zu bytes)\n", path, file_size);
+
+	int ret = 0;
+	ret |= benchmark_parser("fscanf + push_back", file_size, [path]() {
+		std::vector<int> values;
+		return read_positions_fscanf(path, values) == 0 ? (long)values.size() : -1;
+	});
+	ret |= benchmark_parser("mmap -> vector", file_size, [path]() {
+		std::vector<int> values;
+		return read_positions(path, values) == 0 ? (long)values.size() : -1;
+	});
+	ret |= benchmark_parser("mmap -> histogram", file_size, [path]() {
+		CrabHistogram hist;
+		return read_positions(path, hist) == 0 ? hist.num_crabs : -1;
+	});
+	ret |= benchmark_parser("chunked -> histogram", file_size, [path]() {
+		CrabHistogram hist;
+		int fd = open(path, O_RDONLY);
+		if (fd < 0) {
+			return -1L;
+		}
+		int err = parse_stream(fd, [&hist](int pos) { add_crab(hist, pos); });
+		close(fd);
+		compute_prefix_sums(hist);
+		return err == 0 ? hist.num_crabs : -1;
+	});
+
+	return ret == 0 ? 0 : 1;
+}
+
+int main(int argc, char *argv[])
+{
+	const char *input_path = "../day7/input.txt";
+	bool benchmark = false;
+	bool brute_force = false;
+	long report_interval = 0;
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--bench") == 0) {
+			benchmark = true;
+		} else if (strcmp(argv[i], "--brute") == 0) {
+			brute_force = true;
+		} else if (strcmp(argv[i], "--stream") == 0 && i + 1 < argc) {
+			report_interval = atol(argv[++i]);
+			if (report_interval <= 0) {
+				printf("Invalid report interval %s.\n", argv[i]);
+				return 1;
 			}
-			total_fuel += fuel_for_steps;
+		} else {
+			input_path = argv[i];
 		}
-		total_fuels[idx] = total_fuel;
-		idx++;
 	}
 
-	std::sort(std::begin(total_fuels), std::end(total_fuels));
-	printf("Part 2, total fuel: %d\n", total_fuels[0]);
+	if (benchmark) {
+		return run_parse_benchmark(input_path);
+	}
+
+	if (report_interval > 0) {
+		return run_stream(input_path, report_interval);
+	}
+
+	CrabHistogram hist;
+	if (read_positions(input_path, hist) != 0) {
+		return 1;
+	}
+
+	Alignment part1 = find_min_fuel<LinearCost>(hist, brute_force);
+	printf("Part 1, total fuel: %ld\n", part1.fuel);
+
+	Alignment part2 = find_min_fuel<TriangularCost>(hist, brute_force);
+	printf("Part 2, total fuel: %ld\n", part2.fuel);
+
+	if (brute_force) {
+		Alignment discount = find_min_fuel<BulkDiscountCost>(hist);
+		printf("Bulk discount, total fuel: %ld\n", discount.fuel);
+	}
 	return 0;
 }
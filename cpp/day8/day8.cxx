@@ -1,50 +1,27 @@
 #include <cstdio>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
 #include <vector>
 #include <string>
-#include <iostream>
 #include <fstream>
-#include <unordered_map>
+#include <iterator>
+#include <array>
 #include <algorithm>
-#include <cmath>
+#include <thread>
+#include <fcntl.h>
+#include <unistd.h>
 
-static bool are_segments_a_in_b(const std::string& a, const std::string& b)
-{
-	if (a.length() > b.length()) {
-		printf("a has more segments than b. Expect that b should have more.\n");
-		return false;
-	}
-
-	for (auto letter: a) {
-		if (b.find(letter) == std::string::npos) {
-			return false;
-		}
-	}
-
-	return true;
-}
+// Segments are stored as 7 bit masks where bit 0 is wire 'a' and bit 6 is 'g'
+struct DisplayLine {
+	uint8_t patterns[10];	// the unique signal patterns, normally all ten
+	uint8_t outputs[4];	// the four digit output value
+	uint8_t num_patterns;
+};
 
-// Returns number of similar/shared segments in a and b
-static int get_num_similar_segments(const std::string& a, const std::string& b)
+static int count_segments(uint8_t segments)
 {
-	int total_similarities = 0;
-	std::string all_possible_segments = "abcdefg";
-	for (auto segment: all_possible_segments) {
-		bool found_in_a = false;
-		bool found_in_b = false;
-		if (a.find(segment) != std::string::npos) {
-			found_in_a = true;
-		}
-
-		if (b.find(segment) != std::string::npos) {
-			found_in_b = true;
-		}
-
-		if (found_in_a && found_in_b) {
-			total_similarities++;
-		}
-	}
-
-	return total_similarities;
+	return __builtin_popcount(segments);
 }
 
 static bool num_segments_is_unique(int num_segments)
@@ -66,153 +43,410 @@ static bool num_segments_is_unique(int num_segments)
 }
 
 
-// Returns number represented by segments, or -1 if not a unique number of segments
-static int decode_unique_num_segments(const std::string& segments)
+// Segments lit up for each digit with the standard wiring
+static constexpr uint8_t DIGIT_SEGMENTS[10] = {
+	0b1110111, 0b0100100, 0b1011101, 0b1101101, 0b0101110,
+	0b1101011, 0b1111011, 0b0100101, 0b1111111, 0b1101111
+};
+
+// Maps a standard wiring segment mask back to its digit, -1 if it isn't one
+static constexpr std::array<int8_t, 128> build_segments_to_digit(void)
 {
-	int num_segments = segments.length();
-	switch (num_segments) {
-		case 2:
-			return 1;
-		case 3:
-			return 7;
-		case 4:
-			return 4;
-		case 7:
-			return 8;
-		default:
-			return -1;
+	std::array<int8_t, 128> table = {};
+	for (auto& digit: table) {
+		digit = -1;
+	}
+	for (int digit = 0; digit < 10; digit++) {
+		table[DIGIT_SEGMENTS[digit]] = digit;
 	}
+	return table;
 }
+static constexpr auto SEGMENTS_TO_DIGIT = build_segments_to_digit();
 
-// Returns number represented by segments, or -1 on error
-static int decode_segments(const std::string& segments,
-			   std::unordered_map<int, std::string>& unique_nums)
+// Across all ten digits each segment is lit a different number of times (a: 8,
+// b: 6, c: 8, d: 7, e: 4, f: 9, g: 7). Summing those counts over the segments of
+// a digit gives a signature that is unique per digit and doesn't depend on the
+// wiring, since a wire is lit exactly as often as the segment it drives.
+static constexpr int MAX_SIGNATURE = 7 * 10;
+static constexpr std::array<int8_t, MAX_SIGNATURE + 1> build_signature_to_digit(void)
 {
-	int num_segments = segments.length();
-	switch (num_segments) {
-		case 2:
-		case 3:
-		case 4:
-		case 7:
-			return decode_unique_num_segments(segments);
-		case 5:
-		{
-			// Length 5 and contains 7 -> 3
-			if (are_segments_a_in_b(unique_nums[7], segments)) {
-				return 3;
+	int segment_counts[7] = {};
+	for (int digit = 0; digit < 10; digit++) {
+		for (int segment = 0; segment < 7; segment++) {
+			segment_counts[segment] += (DIGIT_SEGMENTS[digit] >> segment) & 1;
+		}
+	}
+
+	std::array<int8_t, MAX_SIGNATURE + 1> table = {};
+	for (auto& digit: table) {
+		digit = -1;
+	}
+	for (int digit = 0; digit < 10; digit++) {
+		int signature = 0;
+		for (int segment = 0; segment < 7; segment++) {
+			signature += ((DIGIT_SEGMENTS[digit] >> segment) & 1) * segment_counts[segment];
+		}
+		table[signature] = digit;
+	}
+	return table;
+}
+static constexpr auto SIGNATURE_TO_DIGIT = build_signature_to_digit();
+
+// One of the 7! ways the wires can be connected to the segments
+struct Wiring {
+	uint64_t patterns[2];		// bit m is set if scrambled mask m is one of the digits
+	uint8_t wire_to_segment[7];
+};
+
+static constexpr int NUM_WIRINGS = 5040;
+static constexpr std::array<Wiring, NUM_WIRINGS> build_wirings(void)
+{
+	std::array<Wiring, NUM_WIRINGS> wirings = {};
+	for (int index = 0; index < NUM_WIRINGS; index++) {
+		// Treat the index as a Lehmer code, picking each segment's wire out of
+		// the ones that are left
+		uint8_t unused_wires[7] = {0, 1, 2, 3, 4, 5, 6};
+		uint8_t segment_to_wire[7] = {};
+		int code = index;
+		int factorial = NUM_WIRINGS / 7;
+		for (int segment = 0; segment < 7; segment++) {
+			int pick = code / factorial;
+			code %= factorial;
+			segment_to_wire[segment] = unused_wires[pick];
+			for (int i = pick; i < 6 - segment; i++) {
+				unused_wires[i] = unused_wires[i + 1];
+			}
+			if (segment < 6) {
+				factorial /= 6 - segment;
 			}
+		}
 
-			// To tell 2 and 5 apart we can compare the number of shared
-			// segments with digit 4.
-			int similarities = get_num_similar_segments(unique_nums[4], segments);
-			if (similarities == 3) {
-				return 5;
-			} else if (similarities == 2) {
-				return 2;
-			} else {
-				printf("Unknown similarities: %d\n", similarities);
+		Wiring& wiring = wirings[index];
+		for (int segment = 0; segment < 7; segment++) {
+			wiring.wire_to_segment[segment_to_wire[segment]] = segment;
+		}
+		for (int digit = 0; digit < 10; digit++) {
+			int scrambled = 0;
+			for (int segment = 0; segment < 7; segment++) {
+				if ((DIGIT_SEGMENTS[digit] >> segment) & 1) {
+					scrambled |= 1 << segment_to_wire[segment];
+				}
 			}
+			wiring.patterns[scrambled / 64] |= 1ULL << (scrambled % 64);
+		}
+	}
+	return wirings;
+}
+static constexpr auto WIRINGS = build_wirings();
 
+static int get_signature(uint8_t segments, const int wire_counts[7])
+{
+	int signature = 0;
+	for (int wire = 0; wire < 7; wire++) {
+		signature += ((segments >> wire) & 1) * wire_counts[wire];
+	}
+	return signature;
+}
+
+// Fast path for lines with all ten patterns. Returns -1 if the patterns aren't
+// ten distinct digits or an output isn't one of them.
+static int decode_line_by_signature(const DisplayLine& line)
+{
+	int wire_counts[7] = {};
+	for (int wire = 0; wire < 7; wire++) {
+		for (uint8_t p: line.patterns) {
+			wire_counts[wire] += (p >> wire) & 1;
+		}
+	}
+
+	uint8_t digit_patterns[10] = {};
+	int digits_seen = 0;
+	for (uint8_t p: line.patterns) {
+		int digit = SIGNATURE_TO_DIGIT[get_signature(p, wire_counts)];
+		if (digit < 0) {
 			return -1;
 		}
-		case 6:
-		{
-			// Length 6 and contains 4 -> 9
-			if (are_segments_a_in_b(unique_nums[4], segments)) {
-				return 9;
-			}
+		digits_seen |= 1 << digit;
+		digit_patterns[digit] = p;
+	}
+	if (digits_seen != (1 << 10) - 1) {
+		return -1;
+	}
 
-			// Length 6, contains 1, not 9 -> 0
-			if (are_segments_a_in_b(unique_nums[1], segments)) {
-				return 0;
-			}
+	int output_num = 0;
+	for (uint8_t o: line.outputs) {
+		int digit = SIGNATURE_TO_DIGIT[get_signature(o, wire_counts)];
+		if (digit < 0 || digit_patterns[digit] != o) {
+			return -1;
+		}
+		output_num = output_num * 10 + digit;
+	}
+	return output_num;
+}
 
-			// Else has to be 6
-			return 6;
+// Checks every possible wiring against the patterns and outputs that are
+// present. Returns -1 if no wiring fits or the fitting ones disagree on the
+// output value.
+static int decode_line_by_wiring(const DisplayLine& line)
+{
+	uint64_t seen[2] = {};
+	for (int i = 0; i < line.num_patterns; i++) {
+		seen[line.patterns[i] / 64] |= 1ULL << (line.patterns[i] % 64);
+	}
+	for (uint8_t o: line.outputs) {
+		seen[o / 64] |= 1ULL << (o % 64);
+	}
+
+	int output_num = -1;
+	for (const Wiring& wiring: WIRINGS) {
+		if (((seen[0] & ~wiring.patterns[0]) | (seen[1] & ~wiring.patterns[1])) != 0) {
+			continue;
 		}
-		default:
-			printf("Unknown num segments %d\n", num_segments);
+
+		int candidate = 0;
+		for (uint8_t o: line.outputs) {
+			int segments = 0;
+			for (int wire = 0; wire < 7; wire++) {
+				segments |= ((o >> wire) & 1) << wiring.wire_to_segment[wire];
+			}
+			candidate = candidate * 10 + SEGMENTS_TO_DIGIT[segments];
+		}
+
+		if (output_num >= 0 && candidate != output_num) {
 			return -1;
+		}
+		output_num = candidate;
+	}
+	return output_num;
+}
+
+// Returns the four digit output value of a line, or -1 if it can't be decoded.
+// Lines missing some of their patterns still decode as long as they narrow the
+// wiring down to a single output value.
+static int decode_line(const DisplayLine& line)
+{
+	if (line.num_patterns == 10) {
+		int output_num = decode_line_by_signature(line);
+		if (output_num >= 0) {
+			return output_num;
+		}
 	}
+	return decode_line_by_wiring(line);
 }
 
-int main()
+// Builds DisplayLines from "<patterns> | <4 outputs>" text, setting each segment
+// mask bit as the letters go by. Only the line being parsed is kept, so the
+// input can be fed in chunks of any size.
+class DisplayLineParser
 {
-	// Every 10 input values contains the input values of a single line
-	std::vector<std::string> input_vals;
+public:
+	// Passes each complete line to sink(const DisplayLine&). Returns -1 on a
+	// malformed line.
+	template <typename Sink>
+	int feed(const char *data, size_t len, Sink&& sink);
 
-	// Every 4 output values contains the output values of a single line
-	std::vector<std::string> output_vals;
+	// Ends the last line if the input didn't end with a newline
+	template <typename Sink>
+	int finish(Sink&& sink) { return feed("\n", 1, sink); }
+private:
+	DisplayLine m_line = {};
+	int m_num_outputs = 0;
+	bool m_output_val = false;
+	uint8_t m_segments = 0;
+	long m_line_number = 1;
+};
 
-	int num_input_lines = 0;
-	bool output_val = false;
-	std::string str;
-	std::ifstream input;
-	input.open("../day8/input.txt");
-	while (input >> str)
-	{
-		if (str == "|") {
-			output_val = true;
+template <typename Sink>
+int DisplayLineParser::feed(const char *data, size_t len, Sink&& sink)
+{
+	for (size_t i = 0; i < len; i++) {
+		char c = data[i];
+		if (c >= 'a' && c <= 'g') {
+			m_segments |= 1 << (c - 'a');
 			continue;
 		}
 
-		if (output_val) {
-			output_vals.push_back(str);
-		} else {
-			input_vals.push_back(str);
+		// Any other character ends the current pattern
+		if (m_segments != 0) {
+			if (!m_output_val && m_line.num_patterns < 10) {
+				m_line.patterns[m_line.num_patterns++] = m_segments;
+			} else if (m_output_val && m_num_outputs < 4) {
+				m_line.outputs[m_num_outputs++] = m_segments;
+			} else {
+				printf("%s: too many patterns on line %ld.\n", __func__, m_line_number);
+				return -1;
+			}
+			m_segments = 0;
 		}
 
-		if (input.peek() == '\n') {
-			output_val = false;
-			num_input_lines++;
+		if (c == '|') {
+			m_output_val = true;
+		} else if (c == '\n') {
+			if (m_line.num_patterns > 0 || m_num_outputs > 0) {
+				if (m_num_outputs != 4) {
+					printf("%s: incomplete line %ld.\n", __func__, m_line_number);
+					return -1;
+				}
+				sink(m_line);
+			}
+			m_line = {};
+			m_num_outputs = 0;
+			m_output_val = false;
+			m_line_number++;
 		}
 	}
-	input.close();
 
+	return 0;
+}
+
+static int parse_display_lines(const char *data, size_t len, std::vector<DisplayLine>& lines)
+{
+	DisplayLineParser parser;
+	auto sink = [&lines](const DisplayLine& line) { lines.push_back(line); };
+	if (parser.feed(data, len, sink) != 0) {
+		return -1;
+	}
+	return parser.finish(sink);
+}
+
+// Running answers for a set of display lines
+struct DecodeTotals {
+	long num_unique_outputs = 0;	// part 1
+	long sum_of_outputs = 0;	// part 2
+	long num_undecoded = 0;		// lines left out of sum_of_outputs
+};
+
+static void add_line_to_totals(const DisplayLine& line, DecodeTotals& totals)
+{
 	// For part 1 count how many output values use a unique number of segments
-	int num_unique_numbers = 0;
-	int num_segments = 0;
-	for (auto s: output_vals) {
-		num_segments = s.length();
-		if (num_segments_is_unique(num_segments)) {
-			num_unique_numbers++;
-		}
-	}
-
-	printf("Part 1 - num unique output numbers: %d\n", num_unique_numbers);
-
-	// For part 2 compare segments from known unique numbers to others
-	// to figure out what number is represented by the segments. Combine
-	// the output digits and add to a total sum.
-	const int num_inputs_per_line = 10;
-	const int num_outputs_per_line = 4;
-	int total_sum_of_outputs = 0;
-	for (int line = 0; line < num_input_lines; line++) {
-		// Save unique numbers from inputs in a map where the digit is the key
-		// and segments are the value
-		std::unordered_map<int, std::string> unique_numbers;
-		int start = line * num_inputs_per_line;
-		int end = start + num_inputs_per_line;
-		for (int i = start; i < end; i++) {
-			int decoded_num = decode_unique_num_segments(input_vals[i]);
-			if (decoded_num != -1) {
-				unique_numbers[decoded_num] = input_vals[i];
+	for (uint8_t s: line.outputs) {
+		if (num_segments_is_unique(count_segments(s))) {
+			totals.num_unique_outputs++;
+		}
+	}
+
+	// For part 2 work out the wiring of the line to decode its output value
+	int output_num = decode_line(line);
+	if (output_num < 0) {
+		totals.num_undecoded++;
+		return;
+	}
+	totals.sum_of_outputs += output_num;
+}
+
+// Every line decodes independently, so the lines are split into one chunk per
+// thread, each thread adds its chunk up locally and the chunk totals are summed
+// at the end.
+static DecodeTotals decode_lines_parallel(const std::vector<DisplayLine>& lines, int num_threads)
+{
+	num_threads = std::max(1, std::min<int>(num_threads, lines.size()));
+	std::vector<DecodeTotals> chunk_totals(num_threads);
+	std::vector<std::thread> threads;
+	for (int t = 0; t < num_threads; t++) {
+		threads.emplace_back([&lines, &chunk_totals, num_threads, t]() {
+			size_t start = lines.size() * t / num_threads;
+			size_t end = lines.size() * (t + 1) / num_threads;
+			DecodeTotals totals;
+			for (size_t i = start; i < end; i++) {
+				add_line_to_totals(lines[i], totals);
+			}
+			chunk_totals[t] = totals;
+		});
+	}
+
+	DecodeTotals totals;
+	for (int t = 0; t < num_threads; t++) {
+		threads[t].join();
+		totals.num_unique_outputs += chunk_totals[t].num_unique_outputs;
+		totals.sum_of_outputs += chunk_totals[t].sum_of_outputs;
+		totals.num_undecoded += chunk_totals[t].num_undecoded;
+	}
+	return totals;
+}
+
+// Decodes each line as soon as it has been read and only keeps the running
+// totals, so memory use doesn't depend on the input size. A path of "-" reads
+// from stdin.
+static int decode_stream(const char *path, DecodeTotals& totals)
+{
+	int fd = STDIN_FILENO;
+	if (strcmp(path, "-") != 0) {
+		fd = open(path, O_RDONLY);
+		if (fd < 0) {
+			printf("Failed to open input file.\n");
+			return -1;
+		}
+	}
+
+	char buf[64 * 1024];
+	DisplayLineParser parser;
+	auto sink = [&totals](const DisplayLine& line) { add_line_to_totals(line, totals); };
+	ssize_t len;
+	int ret = 0;
+	while (ret == 0 && (len = read(fd, buf, sizeof(buf))) != 0) {
+		if (len < 0) {
+			printf("Failed to read input.\n");
+			ret = -1;
+			break;
+		}
+		ret = parser.feed(buf, len, sink);
+	}
+	if (ret == 0) {
+		ret = parser.finish(sink);
+	}
+
+	if (fd != STDIN_FILENO) {
+		close(fd);
+	}
+	return ret;
+}
+
+int main(int argc, char *argv[])
+{
+	const char *input_path = "../day8/input.txt";
+	int num_threads = std::max(1u, std::thread::hardware_concurrency());
+	bool streaming = false;
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--stream") == 0) {
+			streaming = true;
+		} else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+			num_threads = atoi(argv[++i]);
+			if (num_threads <= 0) {
+				printf("Invalid number of threads %s.\n", argv[i]);
+				return 1;
 			}
+		} else {
+			input_path = argv[i];
 		}
+	}
 
-		// Decode outputs and combine with base 10 math
-		start = line * num_outputs_per_line;
-		end = start + num_outputs_per_line;
-		int output_num = 0;
-		for (int i = start; i < end; i++) {
-			int num = decode_segments(output_vals[i], unique_numbers);
-			output_num += num * pow(10, end - 1 - i);
+	DecodeTotals totals;
+	if (streaming) {
+		if (decode_stream(input_path, totals) != 0) {
+			return 1;
+		}
+	} else {
+		std::ifstream input(input_path, std::ios::binary);
+		if (!input) {
+			printf("Failed to open input file.\n");
+			return 1;
 		}
+		std::string data((std::istreambuf_iterator<char>(input)),
+				 std::istreambuf_iterator<char>());
+		input.close();
 
-		// Add the digits of this line to the total sum
-		total_sum_of_outputs += output_num;
+		std::vector<DisplayLine> lines;
+		if (parse_display_lines(data.data(), data.size(), lines) != 0) {
+			return 1;
+		}
+		totals = decode_lines_parallel(lines, num_threads);
 	}
 
-	printf("Part 2 - total sum of outputs: %d\n", total_sum_of_outputs);
+	printf("Part 1 - num unique output numbers: %ld\n", totals.num_unique_outputs);
+	printf("Part 2 - total sum of outputs: %ld\n", totals.sum_of_outputs);
+	if (totals.num_undecoded > 0) {
+		printf("Lines that could not be decoded: %ld\n", totals.num_undecoded);
+		return 1;
+	}
 	return 0;
 }
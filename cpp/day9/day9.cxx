@@ -1,126 +1,893 @@
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <cstdlib>
+#include <cctype>
 #include <fstream>
+#include <iostream>
+#include <string>
 #include <vector>
+#include <set>
+#include <algorithm>
+#include <functional>
+#include <chrono>
+#include <thread>
 
-// Fills in neighbor positions (pairs of <row, col>)
-static int get_neighbors(int row, int col, const std::vector<std::vector<int>>& grid,
-			 std::vector<std::pair<int, int>>& neighbors)
+// Number of points compared at once when looking for low points
+#define VECTOR_WIDTH	(32)
+
+// Lowered to whatever vector registers the target has
+typedef uint8_t u8x32 __attribute__((vector_size(VECTOR_WIDTH)));
+typedef uint16_t u16x32 __attribute__((vector_size(2 * VECTOR_WIDTH)));
+
+// Heights stored row by row in one buffer and surrounded by a border of 9s, so
+// every point has four neighbors and 9s never count as lower. Rows are padded
+// with more 9s out to a multiple of the vector width, and there's an extra
+// vector of 9s at the end, so whole vectors can be loaded anywhere in the map.
+struct Heightmap {
+	int num_rows = 0;
+	int num_cols = 0;
+	int stride = 0;			// bytes per row, including border and padding
+	std::vector<uint8_t> heights;
+
+	// Index of a point, rows -1 and num_rows and col -1 are the border
+	size_t index(int row, int col) const { return (size_t)(row + 1) * stride + col + 1; }
+	const uint8_t *row_start(int row) const { return &heights[index(row, 0)]; }
+};
+
+// Neighbors of a point in a Heightmap, or in rows padded the same way: the 4
+// sharing an edge or all 8 around it. The count is a compile time constant so
+// loops over the offsets unroll, and because the map is surrounded by 9s none
+// of the offsets need bounds checks. Points on the edge of the map pay for
+// their missing neighbors once, when the padding is laid out.
+template <int Connectivity>
+struct Stencil {
+	static_assert(Connectivity == 4 || Connectivity == 8, "Stencils are 4 or 8 connected");
+	long offsets[Connectivity];
+
+	explicit Stencil(long stride)
+	{
+		offsets[0] = -stride;
+		offsets[1] = -1;
+		offsets[2] = 1;
+		offsets[3] = stride;
+		if constexpr (Connectivity == 8) {
+			offsets[4] = -stride - 1;
+			offsets[5] = -stride + 1;
+			offsets[6] = stride - 1;
+			offsets[7] = stride + 1;
+		}
+	}
+};
+
+static int read_heightmap(const char *path, Heightmap& map)
 {
-	if (row < 0 || col < 0 || row >= grid.size() || col >= grid[0].size()) {
-		printf("%s: invalid input params.\n", __func__);
+	std::ifstream input(path);
+	if (!input) {
+		printf("Failed to open input file.\n");
+		return -1;
+	}
+
+	for (std::string line; std::getline(input, line); ) {
+		if (map.num_rows == 0) {
+			map.num_cols = line.length();
+			map.stride = (map.num_cols + 2 + VECTOR_WIDTH - 1) / VECTOR_WIDTH * VECTOR_WIDTH;
+			map.heights.assign(map.stride, 9);
+		} else if ((int)line.length() != map.num_cols) {
+			printf("%s: row %d has %zu points, expected %d.\n", __func__,
+			       map.num_rows + 1, line.length(), map.num_cols);
+			return -1;
+		}
+
+		map.heights.resize(map.heights.size() + map.stride, 9);
+		uint8_t *row = &map.heights[map.index(map.num_rows, 0)];
+		for (int col = 0; col < map.num_cols; col++) {
+			row[col] = line[col] - '0';
+		}
+		map.num_rows++;
+	}
+
+	if (map.num_rows == 0) {
+		printf("%s: empty heightmap.\n", __func__);
+		return -1;
+	}
+	map.heights.resize(map.heights.size() + map.stride + VECTOR_WIDTH, 9);
+
+	return 0;
+}
+
+// Sums the risk level (height + 1) of the low points in one row, comparing a
+// vector of points at a time with the vectors above, below and shifted one
+// left and right (plus the diagonals for 8 connectivity). The rows have to be
+// padded like Heightmap rows.
+template <int Connectivity>
+static long row_low_point_risk(const uint8_t *up, const uint8_t *row, const uint8_t *down,
+			       int num_cols)
+{
+	long total_risk = 0;
+	for (int col = 0; col < num_cols; col += VECTOR_WIDTH) {
+		u8x32 center, above, below, left, right;
+		memcpy(&center, row + col, sizeof(center));
+		memcpy(&above, up + col, sizeof(above));
+		memcpy(&below, down + col, sizeof(below));
+		memcpy(&left, row + col - 1, sizeof(left));
+		memcpy(&right, row + col + 1, sizeof(right));
+
+		// A point is a low point if it is smaller than all of its neighbors
+		u8x32 is_low = (u8x32)((center < above) & (center < below) &
+				       (center < left) & (center < right));
+		if constexpr (Connectivity == 8) {
+			u8x32 up_left, up_right, down_left, down_right;
+			memcpy(&up_left, up + col - 1, sizeof(up_left));
+			memcpy(&up_right, up + col + 1, sizeof(up_right));
+			memcpy(&down_left, down + col - 1, sizeof(down_left));
+			memcpy(&down_right, down + col + 1, sizeof(down_right));
+			is_low &= (u8x32)((center < up_left) & (center < up_right) &
+					  (center < down_left) & (center < down_right));
+		}
+		u8x32 risk = (center + 1) & is_low;
+
+		u16x32 wide_risk = __builtin_convertvector(risk, u16x32);
+		for (int lane = 0; lane < VECTOR_WIDTH; lane++) {
+			total_risk += wide_risk[lane];
+		}
+	}
+
+	return total_risk;
+}
+
+template <int Connectivity>
+static long sum_low_point_risk(const Heightmap& map)
+{
+	long total_risk = 0;
+	for (int row = 0; row < map.num_rows; row++) {
+		total_risk += row_low_point_risk<Connectivity>(map.row_start(row - 1), map.row_start(row),
+						 map.row_start(row + 1), map.num_cols);
+	}
+	return total_risk;
+}
+
+// Labels every basin (area of points that aren't 9) in one pass over the map
+// and returns their sizes. Each unvisited basin point starts a flood fill using
+// an explicit work stack, so there's no recursion depth to worry about. The
+// border of 9s means neighbors never need bounds checks.
+template <int Connectivity>
+static std::vector<int> label_basins(const Heightmap& map)
+{
+	std::vector<int> basin_sizes;
+	std::vector<bool> visited(map.heights.size(), false);
+	std::vector<size_t> to_visit;
+	const Stencil<Connectivity> stencil(map.stride);
+	for (int row = 0; row < map.num_rows; row++) {
+		for (int col = 0; col < map.num_cols; col++) {
+			size_t start = map.index(row, col);
+			if (map.heights[start] == 9 || visited[start]) {
+				continue;
+			}
+
+			int basin_size = 0;
+			visited[start] = true;
+			to_visit.push_back(start);
+			while (!to_visit.empty()) {
+				size_t p = to_visit.back();
+				to_visit.pop_back();
+				basin_size++;
+
+				for (long offset: stencil.offsets) {
+					size_t n = p + offset;
+					if (map.heights[n] != 9 && !visited[n]) {
+						visited[n] = true;
+						to_visit.push_back(n);
+					}
+				}
+			}
+			basin_sizes.push_back(basin_size);
+		}
+	}
+
+	return basin_sizes;
+}
+
+// Union-find over basin fragments, tracking the number of points in each set
+class DisjointSets
+{
+public:
+	// Adds a new set of the given size and returns its id
+	int add(long size);
+
+	int find(int id);
+	void merge(int a, int b);
+	long get_size(int id) { return m_size[find(id)]; }
+	int get_num_ids(void) { return m_parent.size(); }
+
+	// Removes all sets, keeping the memory around for reuse
+	void clear(void) { m_parent.clear(); m_size.clear(); }
+private:
+	std::vector<int> m_parent;
+	std::vector<long> m_size;
+};
+
+int DisjointSets::add(long size)
+{
+	m_parent.push_back(m_parent.size());
+	m_size.push_back(size);
+	return m_parent.size() - 1;
+}
+
+int DisjointSets::find(int id)
+{
+	while (m_parent[id] != id) {
+		// Path halving
+		m_parent[id] = m_parent[m_parent[id]];
+		id = m_parent[id];
+	}
+	return id;
+}
+
+void DisjointSets::merge(int a, int b)
+{
+	a = find(a);
+	b = find(b);
+	if (a == b) {
+		return;
+	}
+
+	if (m_size[a] < m_size[b]) {
+		std::swap(a, b);
+	}
+	m_parent[b] = a;
+	m_size[a] += m_size[b];
+}
+
+// Answers for both parts
+struct BasinSummary {
+	long total_risk = 0;
+	std::vector<long> basin_sizes;
+};
+
+// Part 2 answer, or -1 if there are less than 3 basins
+static long multiply_largest_basins(std::vector<long> basin_sizes)
+{
+	if (basin_sizes.size() < 3) {
 		return -1;
 	}
 
-	int up_row = row - 1;
-	if (up_row >= 0) {
-		neighbors.push_back(std::make_pair(up_row, col));
+	std::partial_sort(basin_sizes.begin(), basin_sizes.begin() + 3, basin_sizes.end(),
+			  std::greater<long>());
+	return basin_sizes[0] * basin_sizes[1] * basin_sizes[2];
+}
+
+template <int Connectivity>
+static BasinSummary analyze_sequential(const Heightmap& map)
+{
+	BasinSummary summary;
+	summary.total_risk = sum_low_point_risk<Connectivity>(map);
+	std::vector<int> basin_sizes = label_basins<Connectivity>(map);
+	summary.basin_sizes.assign(basin_sizes.begin(), basin_sizes.end());
+	return summary;
+}
+
+// Splits the map into horizontal tiles of whole rows. Each thread labels the
+// basin fragments in its tile with tile local labels and adds up the tile's
+// low point risk. Afterwards the fragments go into one union-find, and every
+// pair of non-9 points facing each other across a tile border merges their
+// fragments into the same basin.
+template <int Connectivity>
+static BasinSummary analyze_parallel(const Heightmap& map, int num_threads)
+{
+	int num_tiles = std::max(1, std::min(num_threads, map.num_rows));
+	std::vector<int32_t> labels(map.heights.size(), -1);
+	std::vector<std::vector<long>> fragment_sizes(num_tiles);
+	std::vector<long> tile_risk(num_tiles);
+	std::vector<std::thread> threads;
+	for (int t = 0; t < num_tiles; t++) {
+		threads.emplace_back([&, t]() {
+			int first_row = (long)map.num_rows * t / num_tiles;
+			int end_row = (long)map.num_rows * (t + 1) / num_tiles;
+
+			long risk = 0;
+			for (int row = first_row; row < end_row; row++) {
+				risk += row_low_point_risk<Connectivity>(map.row_start(row - 1),
+									 map.row_start(row),
+							   map.row_start(row + 1), map.num_cols);
+			}
+			tile_risk[t] = risk;
+
+			// Same flood fill as label_basins(), but neighbors outside the
+			// tile are left for the merge
+			size_t tile_begin = map.index(first_row, -1);
+			size_t tile_end = map.index(end_row, -1);
+			const Stencil<Connectivity> stencil(map.stride);
+			std::vector<size_t> to_visit;
+			for (size_t start = tile_begin; start < tile_end; start++) {
+				if (map.heights[start] == 9 || labels[start] != -1) {
+					continue;
+				}
+
+				int32_t label = fragment_sizes[t].size();
+				long fragment_size = 0;
+				labels[start] = label;
+				to_visit.push_back(start);
+				while (!to_visit.empty()) {
+					size_t p = to_visit.back();
+					to_visit.pop_back();
+					fragment_size++;
+
+					for (long offset: stencil.offsets) {
+						size_t n = p + offset;
+						if (n >= tile_begin && n < tile_end &&
+						    map.heights[n] != 9 && labels[n] == -1) {
+							labels[n] = label;
+							to_visit.push_back(n);
+						}
+					}
+				}
+				fragment_sizes[t].push_back(fragment_size);
+			}
+		});
+	}
+	for (auto& thread: threads) {
+		thread.join();
+	}
+
+	BasinSummary summary;
+	DisjointSets fragments;
+	std::vector<int> first_id(num_tiles);
+	for (int t = 0; t < num_tiles; t++) {
+		summary.total_risk += tile_risk[t];
+		first_id[t] = fragments.get_num_ids();
+		for (long size: fragment_sizes[t]) {
+			fragments.add(size);
+		}
 	}
 
-	int left_col = col - 1;
-	if (left_col >= 0) {
-		neighbors.push_back(std::make_pair(row, left_col));
+	for (int t = 1; t < num_tiles; t++) {
+		int first_row = (long)map.num_rows * t / num_tiles;
+		for (int col = 0; col < map.num_cols; col++) {
+			size_t below = map.index(first_row, col);
+			if (labels[below] == -1) {
+				continue;
+			}
+
+			// Diagonal neighbors are in the border or padding at the map
+			// edges, which is never labeled
+			for (int shift = (Connectivity == 8 ? -1 : 0);
+			     shift <= (Connectivity == 8 ? 1 : 0); shift++) {
+				size_t above = map.index(first_row - 1, col + shift);
+				if (labels[above] != -1) {
+					fragments.merge(first_id[t - 1] + labels[above],
+							first_id[t] + labels[below]);
+				}
+			}
+		}
 	}
 
-	int right_col = col + 1;
-	if (right_col < grid[0].size()) {
-		neighbors.push_back(std::make_pair(row, right_col));
+	for (int id = 0; id < fragments.get_num_ids(); id++) {
+		if (fragments.find(id) == id) {
+			summary.basin_sizes.push_back(fragments.get_size(id));
+		}
 	}
+	return summary;
+}
+
+// Keeps only the 3 largest of the sizes passed in
+static void add_basin_size(std::vector<long>& largest, long size)
+{
+	largest.push_back(size);
+	std::sort(largest.begin(), largest.end(), std::greater<long>());
+	if (largest.size() > 3) {
+		largest.pop_back();
+	}
+}
+
+// Single pass over the rows as they are read, for maps too big to load. Only
+// three rows of heights are kept for the low point scan. Basins are tracked as
+// fragments that touch the previous row: each horizontal run of non-9 points
+// in the new row joins the fragments above it in a union-find, and a fragment
+// that no run joined can't grow any more, so its basin is complete. Memory
+// depends on the width of the map only. A path of "-" reads from stdin.
+template <int Connectivity>
+static int analyze_stream(const char *path, BasinSummary& summary)
+{
+	std::ifstream file;
+	if (strcmp(path, "-") != 0) {
+		file.open(path);
+		if (!file) {
+			printf("Failed to open input file.\n");
+			return -1;
+		}
+	}
+	std::istream& input = file.is_open() ? file : std::cin;
+
+	int num_cols = -1;
+	size_t row_size = 0;
+	std::vector<uint8_t> ring;
+	uint8_t *rows[3] = {};		// previous, current and next row
+	int num_buffered = 0;		// rows read that haven't been scanned yet
+
+	std::vector<int> prev_labels;	// fragment of each point in the previous row
+	std::vector<long> prev_sizes;	// size of each fragment so far
+	std::vector<long> new_sizes;
+	std::vector<int> run_ids;	// union-find id of each point in the new row
+	std::vector<int> new_label;	// per union-find root, its fragment in the new row
+	std::vector<bool> closed;	// per union-find root, already counted as a basin
+	DisjointSets fragments;
+
+	std::string line;
+	bool done = false;
+	while (!done) {
+		done = !std::getline(input, line);
+		if (done && num_cols < 0) {
+			printf("%s: empty heightmap.\n", __func__);
+			return -1;
+		}
+
+		if (!done) {
+			if (num_cols < 0) {
+				// Same padding as a Heightmap row, with the left border at
+				// index 0 of each row buffer
+				num_cols = line.length();
+				row_size = (num_cols + 2 + VECTOR_WIDTH - 1) / VECTOR_WIDTH * VECTOR_WIDTH +
+					   VECTOR_WIDTH;
+				ring.assign(3 * row_size, 9);
+				for (int i = 0; i < 3; i++) {
+					rows[i] = &ring[i * row_size + 1];
+				}
+				prev_labels.assign(num_cols, -1);
+				run_ids.assign(num_cols, -1);
+			} else if ((int)line.length() != num_cols) {
+				printf("%s: row has %zu points, expected %d.\n", __func__,
+				       line.length(), num_cols);
+				return -1;
+			}
+		}
+
+		// Rotate the ring, the new row goes in the oldest buffer
+		uint8_t *oldest = rows[0];
+		rows[0] = rows[1];
+		rows[1] = rows[2];
+		rows[2] = oldest;
+		memset(rows[2], 9, num_cols);
+		if (!done) {
+			for (int col = 0; col < num_cols; col++) {
+				rows[2][col] = line[col] - '0';
+			}
+			num_buffered++;
+		}
+
+		// Part 1: the middle row has both of its neighbors now
+		if (num_buffered == 2 || (done && num_buffered == 1)) {
+			summary.total_risk += row_low_point_risk<Connectivity>(rows[0], rows[1], rows[2],
+									       num_cols);
+			num_buffered--;
+		}
+
+		// Part 2: join the runs of the new row to the fragments above them
+		fragments.clear();
+		for (long size: prev_sizes) {
+			fragments.add(size);
+		}
+		for (int col = 0; col < num_cols; col++) {
+			if (done || rows[2][col] == 9) {
+				run_ids[col] = -1;
+				continue;
+			}
+
+			if (col > 0 && run_ids[col - 1] != -1) {
+				run_ids[col] = run_ids[col - 1];
+				fragments.merge(run_ids[col], fragments.add(1));
+			} else {
+				run_ids[col] = fragments.add(1);
+			}
+			int first = (Connectivity == 8) ? std::max(col - 1, 0) : col;
+			int last = (Connectivity == 8) ? std::min(col + 1, num_cols - 1) : col;
+			for (int above = first; above <= last; above++) {
+				if (prev_labels[above] != -1) {
+					fragments.merge(run_ids[col], prev_labels[above]);
+				}
+			}
+		}
 
-	int down_row = row + 1;
-	if (down_row < grid.size()) {
-		neighbors.push_back(std::make_pair(down_row, col));
+		// Number the fragments that reach the new row, and count the ones that
+		// don't as finished basins
+		new_label.assign(fragments.get_num_ids(), -1);
+		closed.assign(fragments.get_num_ids(), false);
+		new_sizes.clear();
+		for (int col = 0; col < num_cols; col++) {
+			if (run_ids[col] == -1) {
+				continue;
+			}
+
+			int root = fragments.find(run_ids[col]);
+			if (new_label[root] == -1) {
+				new_label[root] = new_sizes.size();
+				new_sizes.push_back(fragments.get_size(root));
+			}
+		}
+		for (int id = 0; id < (int)prev_sizes.size(); id++) {
+			int root = fragments.find(id);
+			if (new_label[root] == -1 && !closed[root]) {
+				closed[root] = true;
+				add_basin_size(summary.basin_sizes, fragments.get_size(root));
+			}
+		}
+
+		for (int col = 0; col < num_cols; col++) {
+			prev_labels[col] = (run_ids[col] == -1) ? -1 :
+					   new_label[fragments.find(run_ids[col])];
+		}
+		prev_sizes.swap(new_sizes);
 	}
 
 	return 0;
 }
 
-static bool is_low_point(int row, int col, std::vector<std::vector<int>>& grid)
+// Keeps the answers for both parts up to date while single points of the map
+// change. An update only re-checks low points next to the changed point and
+// only relabels the basins it touches: a new 9 can split its basin, and a
+// removed 9 merges the basins around it (relabeling the smaller ones).
+template <int Connectivity>
+class BasinIndex
+{
+public:
+	explicit BasinIndex(const Heightmap& map);
+
+	// Sets the height of a point. Returns -1 on invalid input.
+	int update(int row, int col, int height);
+
+	long get_total_risk(void) { return m_total_risk; }
+
+	// Product of the 3 largest basin sizes, or -1 if there are less than 3
+	long get_largest_basins_product(void) { return m_largest_product; }
+private:
+	Heightmap m_map;
+	std::vector<int32_t> m_labels;		// basin of each point, -1 for 9s
+	std::vector<long> m_basin_sizes;	// size of each basin by label
+	std::vector<int32_t> m_free_labels;	// labels of basins that went away
+	std::multiset<long, std::greater<long>> m_sorted_sizes;
+	long m_total_risk = 0;
+	long m_largest_product = -1;
+	const Stencil<Connectivity> m_stencil;
+	std::vector<size_t> m_to_visit;		// flood fill work stack, kept for reuse
+
+	// Risk level of a point if it's a low point, else 0
+	long get_risk(size_t p);
+
+	int32_t new_basin(void);
+	void free_basin(int32_t label);
+
+	// Relabels the basin containing start from one label to another and
+	// returns the number of points relabeled
+	long relabel(size_t start, int32_t from, int32_t to);
+
+	void update_largest_product(void);
+};
+
+template <int Connectivity>
+BasinIndex<Connectivity>::BasinIndex(const Heightmap& map) : m_map(map), m_stencil(map.stride)
+{
+	m_total_risk = sum_low_point_risk<Connectivity>(m_map);
+	m_labels.assign(m_map.heights.size(), -1);
+	for (int row = 0; row < m_map.num_rows; row++) {
+		for (int col = 0; col < m_map.num_cols; col++) {
+			size_t p = m_map.index(row, col);
+			if (m_map.heights[p] != 9 && m_labels[p] == -1) {
+				int32_t label = new_basin();
+				m_basin_sizes[label] = relabel(p, -1, label);
+				m_sorted_sizes.insert(m_basin_sizes[label]);
+			}
+		}
+	}
+	update_largest_product();
+}
+
+template <int Connectivity>
+long BasinIndex<Connectivity>::get_risk(size_t p)
 {
-	// A point is a low point if it is smaller than all of its neighbors
-	std::vector<std::pair<int, int>> neighbors; // pair<row, col>
-	get_neighbors(row, col, grid, neighbors);
-	for (auto n: neighbors) {
-		if (grid[row][col] >= grid[n.first][n.second]) {
-			return false;
+	uint8_t height = m_map.heights[p];
+	// A 9 is never a low point. Checking it first also keeps the border,
+	// which is all 9s, from looking at neighbors outside the map.
+	if (height == 9) {
+		return 0;
+	}
+	for (long offset: m_stencil.offsets) {
+		if (height >= m_map.heights[p + offset]) {
+			return 0;
 		}
 	}
-	return true;
+	return height + 1;
+}
+
+template <int Connectivity>
+int32_t BasinIndex<Connectivity>::new_basin(void)
+{
+	if (m_free_labels.empty()) {
+		m_basin_sizes.push_back(0);
+		return m_basin_sizes.size() - 1;
+	}
+
+	int32_t label = m_free_labels.back();
+	m_free_labels.pop_back();
+	return label;
+}
+
+template <int Connectivity>
+void BasinIndex<Connectivity>::free_basin(int32_t label)
+{
+	m_basin_sizes[label] = 0;
+	m_free_labels.push_back(label);
+}
+
+template <int Connectivity>
+long BasinIndex<Connectivity>::relabel(size_t start, int32_t from, int32_t to)
+{
+	long num_relabeled = 1;
+	m_to_visit.push_back(start);
+	m_labels[start] = to;
+	while (!m_to_visit.empty()) {
+		size_t p = m_to_visit.back();
+		m_to_visit.pop_back();
+		for (long offset: m_stencil.offsets) {
+			size_t n = p + offset;
+			if (m_labels[n] == from && m_map.heights[n] != 9) {
+				m_labels[n] = to;
+				m_to_visit.push_back(n);
+				num_relabeled++;
+			}
+		}
+	}
+	return num_relabeled;
+}
+
+template <int Connectivity>
+void BasinIndex<Connectivity>::update_largest_product(void)
+{
+	if (m_sorted_sizes.size() < 3) {
+		m_largest_product = -1;
+		return;
+	}
+
+	auto largest = m_sorted_sizes.begin();
+	long product = *largest++;
+	product *= *largest++;
+	m_largest_product = product * *largest;
 }
 
-// Recursively count neighboring basin points (not 9 and haven't been counted already)
-static int get_num_nearby_basin_points(int row, int col,
-				       const std::vector<std::vector<int>>& grid)
+template <int Connectivity>
+int BasinIndex<Connectivity>::update(int row, int col, int height)
 {
-	if (row < 0 || col < 0 || row >= grid.size() || col >= grid[0].size()) {
+	if (row < 0 || row >= m_map.num_rows || col < 0 || col >= m_map.num_cols ||
+	    height < 0 || height > 9) {
 		printf("%s: invalid input params.\n", __func__);
 		return -1;
 	}
 
-	// Keeps track of visited points as recursion does its job
-	static std::vector<std::pair<int, int>> visited;
+	size_t p = m_map.index(row, col);
+	uint8_t old_height = m_map.heights[p];
+
+	// Part 1: only the point and its neighbors can change low point status.
+	m_total_risk -= get_risk(p);
+	for (long offset: m_stencil.offsets) {
+		m_total_risk -= get_risk(p + offset);
+	}
+	m_map.heights[p] = height;
+	m_total_risk += get_risk(p);
+	for (long offset: m_stencil.offsets) {
+		m_total_risk += get_risk(p + offset);
+	}
+
+	// Part 2: basins only change when a 9 is added or removed
+	if (old_height != 9 && height == 9) {
+		// Split what's left of the basin into the parts still connected
+		int32_t old_label = m_labels[p];
+		m_sorted_sizes.erase(m_sorted_sizes.find(m_basin_sizes[old_label]));
+		m_labels[p] = -1;
+		for (long offset: m_stencil.offsets) {
+			size_t n = p + offset;
+			if (m_labels[n] == old_label) {
+				int32_t label = new_basin();
+				m_basin_sizes[label] = relabel(n, old_label, label);
+				m_sorted_sizes.insert(m_basin_sizes[label]);
+			}
+		}
+		free_basin(old_label);
+	} else if (old_height == 9 && height != 9) {
+		// Merge the neighboring basins into the largest one
+		int32_t largest = -1;
+		for (long offset: m_stencil.offsets) {
+			int32_t label = m_labels[p + offset];
+			if (label != -1 && (largest == -1 ||
+					    m_basin_sizes[label] > m_basin_sizes[largest])) {
+				largest = label;
+			}
+		}
 
-	std::vector<std::pair<int, int>> neighbors;
-	get_neighbors(row, col, grid, neighbors);
+		if (largest == -1) {
+			largest = new_basin();
+		} else {
+			m_sorted_sizes.erase(m_sorted_sizes.find(m_basin_sizes[largest]));
+		}
+		m_labels[p] = largest;
+		m_basin_sizes[largest]++;
 
-	int basin_size = 0;
-	for (auto n: neighbors) {
-		if (grid[n.first][n.second] != 9) {
-			if (std::find(visited.begin(), visited.end(), n) == visited.end()) {
-				// Point has not been visited before so count it and
-				// count its basin point neighbors
-				visited.push_back(std::make_pair(n.first, n.second));
-				basin_size += 1 + get_num_nearby_basin_points(
-							n.first, n.second, grid);
+		for (long offset: m_stencil.offsets) {
+			int32_t label = m_labels[p + offset];
+			if (label != -1 && label != largest) {
+				m_sorted_sizes.erase(m_sorted_sizes.find(m_basin_sizes[label]));
+				m_basin_sizes[largest] += relabel(p + offset, label, largest);
+				free_basin(label);
 			}
 		}
+		m_sorted_sizes.insert(m_basin_sizes[largest]);
 	}
+	update_largest_product();
 
-	return basin_size;
+	return 0;
 }
 
-int main()
+// Applies "row,col,height" updates from a file one at a time and prints the
+// answers after each one
+template <int Connectivity>
+static int run_updates(const Heightmap& map, const char *updates_path)
 {
-	std::vector<std::vector<int>> heightmap;
-	std::vector<int> low_points;
-	std::vector<int> basin_sizes;
+	FILE *fp = fopen(updates_path, "r");
+	if (!fp) {
+		printf("Failed to open updates file.\n");
+		return -1;
+	}
 
-	// Parse input into heightmap
-	std::ifstream input("../day9/input.txt");
-	for (std::string line; std::getline(input, line); ) {
-		std::vector<int> line_nums;
-		for (char c: line) {
-			line_nums.push_back(c - '0');
-		}
-		heightmap.push_back(line_nums);
-	}
-
-	// Find low points and basins
-	for (int row = 0; row < heightmap.size(); row++) {
-		for (int col = 0; col < heightmap[0].size(); col++) {
-			if (is_low_point(row, col, heightmap))
-			{
-				// All low points are at the bottom of a basin
-				low_points.push_back(heightmap[row][col]);
-				int basin_size = get_num_nearby_basin_points(row, col, heightmap);
-				if (basin_size > 0) {
-					basin_sizes.push_back(basin_size);
-				}
-			}
+	BasinIndex<Connectivity> index(map);
+	printf("Initial: Part 1: %ld, Part 2: %ld\n", index.get_total_risk(),
+	       index.get_largest_basins_product());
+
+	int row, col, height;
+	int ret = 0;
+	while (fscanf(fp, "%d,%d,%d", &row, &col, &height) == 3) {
+		if (index.update(row, col, height) != 0) {
+			ret = -1;
+			break;
 		}
+		printf("%d,%d -> %d: Part 1: %ld, Part 2: %ld\n", row, col, height,
+		       index.get_total_risk(), index.get_largest_basins_product());
 	}
+	fclose(fp);
 
-	// Part 1: sum risk level of all low points
-	int total_risk = 0;
-	for (int p: low_points) {
-		total_risk += p + 1;
+	return ret;
+}
+
+// Fills a map with random heights, roughly a third of them 9s
+static void generate_heightmap(Heightmap& map, int num_rows, int num_cols)
+{
+	map.num_rows = num_rows;
+	map.num_cols = num_cols;
+	map.stride = (num_cols + 2 + VECTOR_WIDTH - 1) / VECTOR_WIDTH * VECTOR_WIDTH;
+	map.heights.assign((size_t)(num_rows + 2) * map.stride + VECTOR_WIDTH, 9);
+
+	uint64_t state = 0x9e3779b97f4a7c15ULL;
+	for (int row = 0; row < num_rows; row++) {
+		for (int col = 0; col < num_cols; col++) {
+			// xorshift64
+			state ^= state << 13;
+			state ^= state >> 7;
+			state ^= state << 17;
+			int height = state % 13;
+			map.heights[map.index(row, col)] = std::min(height, 9);
+		}
+	}
+}
+
+// Times the sequential and tiled analysis on a random map, for 1 to max_threads
+// threads, and checks they agree
+template <int Connectivity>
+static int run_scaling_benchmark(int num_rows, int num_cols, int max_threads)
+{
+	using clock = std::chrono::steady_clock;
+	Heightmap map;
+	generate_heightmap(map, num_rows, num_cols);
+	printf("Random %d x %d heightmap\n", num_rows, num_cols);
+
+	auto start = clock::now();
+	BasinSummary expected = analyze_sequential<Connectivity>(map);
+	double baseline = std::chrono::duration<double>(clock::now() - start).count();
+	long expected_product = multiply_largest_basins(expected.basin_sizes);
+	printf("sequential    %8.3f s\n", baseline);
+
+	for (int num_threads = 1; num_threads <= max_threads; num_threads++) {
+		start = clock::now();
+		BasinSummary summary = analyze_parallel<Connectivity>(map, num_threads);
+		double elapsed = std::chrono::duration<double>(clock::now() - start).count();
+		printf("%2d thread(s)  %8.3f s  %5.2fx\n", num_threads, elapsed, baseline / elapsed);
+
+		if (summary.total_risk != expected.total_risk ||
+		    multiply_largest_basins(summary.basin_sizes) != expected_product) {
+			printf("Mismatch with %d threads!\n", num_threads);
+			return 1;
+		}
 	}
 
-	printf("Part 1: %d\n", total_risk);
+	return 0;
+}
 
-	// Part 2: find 3 largest basins and multiply their sizes together
-	if (basin_sizes.size() >= 3) {
-		std::sort(basin_sizes.begin(), basin_sizes.end(), std::greater<int>());
-		printf("Part 2: %d\n", basin_sizes[0] * basin_sizes[1] * basin_sizes[2]);
+// Command line options
+struct Options {
+	const char *input_path = "../day9/input.txt";
+	const char *updates_path = nullptr;
+	int num_threads = 0;
+	bool benchmark = false;
+	bool streaming = false;
+	int bench_rows = 4000;
+	int bench_cols = 4000;
+};
+
+template <int Connectivity>
+static int run(const Options& options)
+{
+	if (options.benchmark) {
+		int max_threads = options.num_threads;
+		if (max_threads == 0) {
+			max_threads = std::max(1u, std::thread::hardware_concurrency());
+		}
+		return run_scaling_benchmark<Connectivity>(options.bench_rows, options.bench_cols,
+							   max_threads);
+	}
+
+	BasinSummary summary;
+	Heightmap heightmap;
+	if (options.streaming) {
+		if (analyze_stream<Connectivity>(options.input_path, summary) != 0) {
+			return 1;
+		}
+	} else if (read_heightmap(options.input_path, heightmap) != 0) {
+		return 1;
+	} else if (options.updates_path) {
+		return run_updates<Connectivity>(heightmap, options.updates_path) == 0 ? 0 : 1;
+	} else if (options.num_threads > 0) {
+		summary = analyze_parallel<Connectivity>(heightmap, options.num_threads);
+	} else {
+		summary = analyze_sequential<Connectivity>(heightmap);
+	}
+
+	// Part 1: sum risk level of all low points
+	printf("Part 1: %ld\n", summary.total_risk);
+
+	// Part 2: find 3 largest basins and multiply their sizes together. Every
+	// point that isn't a 9 belongs to exactly one basin.
+	long product = multiply_largest_basins(summary.basin_sizes);
+	if (product >= 0) {
+		printf("Part 2: %ld\n", product);
 	}
 
 	return 0;
 }
+
+int main(int argc, char *argv[])
+{
+	Options options;
+	bool diagonal = false;
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+			options.num_threads = atoi(argv[++i]);
+			if (options.num_threads <= 0) {
+				printf("Invalid number of threads %s.\n", argv[i]);
+				return 1;
+			}
+		} else if (strcmp(argv[i], "--updates") == 0 && i + 1 < argc) {
+			options.updates_path = argv[++i];
+		} else if (strcmp(argv[i], "--stream") == 0) {
+			options.streaming = true;
+		} else if (strcmp(argv[i], "--diagonal") == 0) {
+			diagonal = true;
+		} else if (strcmp(argv[i], "--bench") == 0) {
+			options.benchmark = true;
+			if (i + 2 < argc && isdigit(argv[i + 1][0]) && isdigit(argv[i + 2][0])) {
+				options.bench_rows = atoi(argv[++i]);
+				options.bench_cols = atoi(argv[++i]);
+			}
+		} else {
+			options.input_path = argv[i];
+		}
+	}
+
+	// Diagonal neighbors count for both low points and basins
+	return diagonal ? run<8>(options) : run<4>(options);
+}